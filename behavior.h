@@ -0,0 +1,316 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * What a simulated process does, independent of how it talks to the master. User runs one as a real process
+ * over the message queue or a ring, and OSS's simulation engine (-e) runs many of them as tasks on its own
+ * threads. Either way the process is a state machine: sim_step says what it does next, either a slice of
+ * work (the caller advances the clock by WORKCONSTANT) or a message to send, and sim_reply hands it the
+ * master's answer. It draws every choice from its own stream of the run's seed in the same order however it
+ * is driven, so the same seed makes the same choices in both.
+ */
+
+#ifndef BEHAVIOR_H
+#define BEHAVIOR_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "clock.c"
+#include "message.h"
+#include "bitset.h"
+#include "proctable.h"
+#include "prng.h"
+
+#define UPPERBOUND 3
+#define DEFAULT_TERMINATE 10    // chance in 1000 a process terminates after each thing it does
+#define WORKCONSTANT 500000
+
+// What sim_step asks the caller to do
+#define SIM_WORK 0              // advance the clock by WORKCONSTANT
+#define SIM_SEND 1              // send the message to the master and pass the reply to sim_reply
+#define SIM_DONE 2              // the process has terminated and the master has acknowledged it
+
+// Where a process is in its loop
+enum {
+    SIM_TOP,                    // about to decide whether to do something
+    SIM_AWAITING,               // waiting for the reply to a request or release
+    SIM_REPLIED,                // got it, about to decide whether to terminate
+    SIM_EXITING,                // waiting for the reply to its termination
+    SIM_EXITED
+};
+
+// What a process holds. The resources it may still request and the ones it may release are kept as bitsets,
+// updated as each reply comes in, so picking one is a popcount and a select instead of a search.
+struct holdings {
+    int *current;               // instances held of each resource
+    uint64_t *can_request;      // bit r set while current[r] < claims[r]
+    uint64_t *can_release;      // bit r set while current[r] > 0
+    int words;
+};
+
+struct sim_process {
+    int simpid;
+    unsigned int generation;
+    int pid;                    // stamped on its messages
+    int phase;
+    int *claims;                // its row of the process table
+    int nresources;
+    int batch;
+    int terminate;              // chance in 1000 of terminating after each thing it does
+    const double *zipf_cum;     // zipf_cum[k] is the weight of ranks 0 to k, NULL to pick uniformly
+    uint64_t *clock;            // its messages are stamped with this clock's time
+    struct prng rng;            // this process's stream of the run's seed
+    struct holdings h;
+};
+
+
+// Builds the weights for picking resources with Zipf exponent skew: rank k among the eligible resources,
+// counting from the lowest numbered, has weight 1 / (k + 1)^skew. Returns NULL for a uniform pick.
+static inline double *zipf_table(double skew, int nresources)
+{
+    double *cum;
+    double total = 0;
+    int k;
+
+    if (skew <= 0 || (cum = malloc(nresources * sizeof(double))) == NULL)
+    {
+        return NULL;
+    }
+    for (k = 0; k < nresources; k++)
+    {
+        total += pow(k + 1, -skew);
+        cum[k] = total;
+    }
+    return cum;
+}
+
+
+// Picks one of the n ranks from 0 to n - 1 by the Zipf weights, with a binary search of the running totals
+static inline int zipf_rank(struct sim_process *p, int n)
+{
+    double u = prng_double(&p->rng) * p->zipf_cum[n - 1];
+    int low = 0, high = n - 1, mid;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (p->zipf_cum[mid] > u)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+
+// Picks a resource from an eligible set, uniformly or by Zipf rank. Returns -1 if the set is empty.
+static inline int choose_eligible(struct sim_process *p, const uint64_t *eligible, int words)
+{
+    int n = bit_count(eligible, words);
+
+    if (n == 0)
+    {
+        return -1;
+    }
+    return bit_select(eligible, words, p->zipf_cum != NULL ? zipf_rank(p, n) : (int)prng_below(&p->rng, n));
+}
+
+
+// Starts a process with nothing held, so everything it claims can be requested and nothing released
+static inline void holdings_reset(struct holdings *h, int *claims, int nresources)
+{
+    int r;
+
+    memset(h->current, 0, nresources * sizeof(int));
+    memset(h->can_request, 0, h->words * sizeof(uint64_t));
+    memset(h->can_release, 0, h->words * sizeof(uint64_t));
+    for (r = 0; r < nresources; r++)
+    {
+        if (claims[r] > 0)
+        {
+            bit_set(h->can_request, r);
+        }
+    }
+}
+
+
+// Applies a change of count instances of resource r and updates both sets for r
+static inline void holdings_change(struct holdings *h, int *claims, int r, int count)
+{
+    h->current[r] += count;
+    if (h->current[r] < claims[r])
+    {
+        bit_set(h->can_request, r);
+    }
+    else
+    {
+        bit_clear(h->can_request, r);
+    }
+    if (h->current[r] > 0)
+    {
+        bit_set(h->can_release, r);
+    }
+    else
+    {
+        bit_clear(h->can_release, r);
+    }
+}
+
+
+// Sets up a process that can run as any simpid of table, choosing resources with the Zipf weights zipf_cum
+// (NULL for uniform) and stamping messages from clock. Returns 0, or -1 if it can't be allocated.
+static inline int sim_init(struct sim_process *p, struct proc_table *table, const double *zipf_cum,
+                           uint64_t *clock)
+{
+    memset(p, 0, sizeof(*p));
+    p->nresources = table->nresources;
+    p->batch = table->batch;
+    p->terminate = table->terminate;
+    p->zipf_cum = zipf_cum;
+    p->clock = clock;
+    p->h.words = BITWORDS(table->nresources);
+    p->h.current = calloc(table->nresources, sizeof(int));
+    p->h.can_request = calloc(p->h.words, sizeof(uint64_t));
+    p->h.can_release = calloc(p->h.words, sizeof(uint64_t));
+    if (p->h.current == NULL || p->h.can_request == NULL || p->h.can_release == NULL)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline void sim_free(struct sim_process *p)
+{
+    free(p->h.current);
+    free(p->h.can_request);
+    free(p->h.can_release);
+}
+
+
+// Starts the given generation of simpid from an empty hand, with its claims from table
+static inline void sim_start(struct sim_process *p, struct proc_table *table, int simpid, unsigned int generation,
+                             int pid)
+{
+    p->simpid = simpid;
+    p->generation = generation;
+    p->pid = pid;
+    p->phase = SIM_TOP;
+    p->claims = proc_table_row(table, simpid);
+    holdings_reset(&p->h, p->claims, p->nresources);
+    prng_init(&p->rng, table->seed, prng_stream(simpid, generation));
+}
+
+
+// Fills in msg for the given operation, stamped with the current simulated time, with no pairs
+static inline void sim_message(struct sim_process *p, struct mesg_buf *msg, int opcode)
+{
+    msg->mtype = MASTER_MTYPE;
+    msg->pid = p->pid;
+    msg->simpid = p->simpid;
+    msg->opcode = opcode;
+    msg->generation = p->generation;
+    msg->timestamp = readClock(p->clock);
+    msg->nitems = 0;
+}
+
+
+// Fills in the pairs of msg for a REQUEST or RELEASE. With a batch size of 1 that is one instance of one
+// eligible resource. Otherwise it is up to batch distinct eligible resources, each with a count of up to what
+// may still be requested, or up to what is held. Returns the number of pairs, 0 if there is nothing to
+// request or release.
+static inline int sim_choose_batch(struct sim_process *p, struct mesg_buf *msg, int opcode)
+{
+    struct holdings *h = &p->h;
+    uint64_t eligible[h->words];
+    int n = p->batch > 1 ? 1 + (int)prng_below(&p->rng, p->batch) : 1;
+    int r, room;
+
+    memcpy(eligible, opcode == REQUEST ? h->can_request : h->can_release, h->words * sizeof(uint64_t));
+    while (msg->nitems < n && (r = choose_eligible(p, eligible, h->words)) != -1)
+    {
+        bit_clear(eligible, r);
+        room = opcode == REQUEST ? p->claims[r] - h->current[r] : h->current[r];
+        msg->items[msg->nitems].resource = r;
+        msg->items[msg->nitems].count = p->batch > 1 ? 1 + (int)prng_below(&p->rng, room) : 1;
+        msg->nitems++;
+    }
+    return msg->nitems;
+}
+
+
+// Runs the process up to the next thing the caller has to do for it. For SIM_SEND the message is left in
+// msg, and the process goes no further until sim_reply is called with the answer.
+static inline int sim_step(struct sim_process *p, struct mesg_buf *msg)
+{
+    int opcode;
+
+    if (p->phase == SIM_EXITED)
+    {
+        return SIM_DONE;
+    }
+    if (p->phase == SIM_TOP)
+    {
+        if (prng_below(&p->rng, UPPERBOUND) == 0)
+        {
+            return SIM_WORK;
+        }
+        // we either request or release resources: release if we hold all we may claim, request if we
+        // hold nothing, otherwise either at even odds
+        if (bit_count(p->h.can_request, p->h.words) == 0)
+        {
+            opcode = RELEASE;
+        }
+        else if (bit_count(p->h.can_release, p->h.words) == 0)
+        {
+            opcode = REQUEST;
+        }
+        else
+        {
+            opcode = prng_below(&p->rng, 2) == 0 ? REQUEST : RELEASE;
+        }
+        sim_message(p, msg, opcode);
+        // with no claims at all there is nothing to request or release
+        if (sim_choose_batch(p, msg, opcode) > 0)
+        {
+            p->phase = SIM_AWAITING;
+            return SIM_SEND;
+        }
+    }
+    // done something, or had nothing to do it with: time to decide whether to terminate
+    p->phase = SIM_TOP;
+    if ((int)prng_below(&p->rng, 1000) < p->terminate)
+    {
+        sim_message(p, msg, TERMINATE);
+        p->phase = SIM_EXITING;
+        return SIM_SEND;
+    }
+    return SIM_WORK;
+}
+
+
+// Hands the process the master's reply to the message it sent. The reply says how many instances of each
+// resource actually changed hands.
+static inline void sim_reply(struct sim_process *p, struct mesg_buf *reply)
+{
+    int j;
+
+    if (p->phase == SIM_EXITING)
+    {
+        p->phase = SIM_EXITED;
+        return;
+    }
+    for (j = 0; j < reply->nitems; j++)
+    {
+        holdings_change(&p->h, p->claims, reply->items[j].resource,
+                        reply->opcode == REQUEST ? reply->items[j].count : -reply->items[j].count);
+    }
+    p->phase = SIM_REPLIED;
+}
+
+#endif
@@ -0,0 +1,1199 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Microbenchmarks for the hot paths shared by OSS and User. Each benchmark prints one line with its name,
+ * the number of operations it ran, and the rate it achieved, so runs can be compared across changes. With -j
+ * each line is a JSON object instead.
+ *
+ * It also drives OSS itself through scenarios: a scenario sets the number of processes and resource classes,
+ * the termination chance, the resource skew, the simulated run length and any other options, and every run of
+ * it uses the same seeds, so the same scenario on two commits runs the same workload. Each run prints one JSON
+ * line: requests and grants per wall second, the master's CPU share, wait percentiles in simulated ns and
+ * peak RSS, read back from the metrics file OSS writes and from its rusage.
+ *
+ * Usage: ./bench [-j] [iterations]
+ *        ./bench -c scenario|all [-r runs] [-o oss] [-s procs] [-n resources] [-x chance] [-z skew] [-T secs]
+ *                [-a "oss options"]
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "clock.c"
+#include "message.h"
+#include "ring.h"
+#include "proctable.h"
+#include "resource.h"
+#include "rowops.h"
+#include "slots.h"
+#include "metrics.h"
+#include "prng.h"
+#include "shard.h"
+#include "events.h"
+
+#define BILLION 1000000000
+#define DEFAULT_ITERATIONS 1000000
+#define WORKCONSTANT 500000
+#define BENCH_SEM_NAME "/bench-clock-jbwd4"
+#define BENCH_RESOURCES 20
+
+// The message format used before the binary protocol, kept here only to compare against
+struct text_mesg_buf {
+    long mtype;
+    char mtext[100];
+};
+
+// A workload for OSS: the knobs the scenario driver turns, and any other options passed through as they are
+struct scenario {
+    const char *name;
+    int procs;                  // -s
+    int resources;              // -n
+    int terminate;              // -x, the chance in 1000 a process terminates after each action
+    double skew;                // -z
+    int seconds;                // -T, simulated
+    const char *options;
+};
+
+static const struct scenario scenarios[] = {
+    {"queue", 18, 20, 10, 0, 2, ""},
+    {"ring-pool", 18, 20, 10, 0, 2, "-r -w"},
+    {"engine", 18, 20, 10, 0, 2, "-e 1"},
+    {"discrete", 18, 20, 10, 0, 2, "-D"},
+    {"contended", 40, 3, 10, 0, 2, "-D -b 3 -i 2"},
+    {"skewed", 40, 20, 10, 1.2, 2, "-D -b 4"},
+    {"churn", 40, 20, 100, 0, 2, "-D -i 1"},
+    {"detection", 40, 8, 10, 0, 2, "-D -d 20 -i 5 -b 4"},
+    {"long", 18, 20, 10, 0, 20, "-D"},
+};
+
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+#define SCENARIO_WALL_LIMIT "60"
+
+// Prevents the compiler from optimizing away the results of a benchmark loop
+volatile long sink;
+// Print results as JSON lines
+int json;
+
+
+// Returns the current wall time in nanoseconds
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+
+// Prints a single result line
+static void report(const char *name, long ops, long long elapsed)
+{
+    if (json)
+    {
+        printf("{\"bench\": \"%s\", \"ops\": %ld, \"ops_per_sec\": %.0f, \"ns_per_op\": %.1f}\n", name, ops,
+               ops * 1e9 / elapsed, (double)elapsed / ops);
+        return;
+    }
+    printf("%-32s %10ld ops %12.0f ops/sec %8.1f ns/op\n", name, ops, ops * 1e9 / elapsed,
+           (double)elapsed / ops);
+}
+
+
+// Formats and parses a request the way the text protocol did
+static void bench_text_codec(long iterations)
+{
+    struct text_mesg_buf msg;
+    char messageString[100];
+    char *temp;
+    long i, total = 0;
+    long long start = now_ns();
+
+    for (i = 0; i < iterations; i++)
+    {
+        msg.mtype = 1;
+        sprintf(msg.mtext, "%d %d %d", 12345, REQUEST, (int)(i % 20));
+        strcpy(messageString, msg.mtext);
+        temp = strtok(messageString, " ");
+        total += atoi(temp);
+        temp = strtok(NULL, " ");
+        total += atoi(temp);
+        temp = strtok(NULL, " ");
+        total += atoi(temp);
+    }
+    sink = total;
+    report("codec/text", iterations, now_ns() - start);
+}
+
+
+// Fills in and reads back a request using the binary protocol
+static void bench_binary_codec(long iterations)
+{
+    struct mesg_buf msg;
+    long i, total = 0;
+    long long start = now_ns();
+
+    for (i = 0; i < iterations; i++)
+    {
+        msg.mtype = MASTER_MTYPE;
+        msg.pid = 12345;
+        msg.simpid = 1;
+        msg.opcode = REQUEST;
+        msg.nitems = 1;
+        msg.items[0].resource = (int)(i % 20);
+        msg.items[0].count = 1;
+        msg.timestamp = (uint64_t)i;
+        sink = msg.items[0].resource;
+        total += msg.pid + msg.opcode + msg.items[0].resource;
+    }
+    sink = total;
+    report("codec/binary", iterations, now_ns() - start);
+}
+
+
+// Bounces a message off a forked echo process through a private message queue, size bytes at a time.
+// This measures the full request/reply round trip a user process pays per request.
+static void bench_queue_roundtrip(const char *name, long iterations, void *buf, size_t size)
+{
+    int qid = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    long i;
+    long long start;
+    pid_t pid;
+
+    if (qid == -1)
+    {
+        perror("bench msgget");
+        return;
+    }
+
+    fflush(stdout);
+    if ((pid = fork()) == 0)
+    {
+        for (i = 0; i < iterations; i++)
+        {
+            msgrcv(qid, buf, size, 1, 0);
+            *(long *)buf = 2;
+            msgsnd(qid, buf, size, 0);
+        }
+        _exit(0);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        *(long *)buf = 1;
+        msgsnd(qid, buf, size, 0);
+        msgrcv(qid, buf, size, 2, 0);
+    }
+    report(name, iterations, now_ns() - start);
+
+    waitpid(pid, NULL, 0);
+    msgctl(qid, IPC_RMID, NULL);
+}
+
+
+// The same round trip over a shared-memory channel: the echo process polls the request ring like the master
+// does and answers through the futex-backed reply slot. ns/op is the request-to-reply latency.
+static void bench_ring_roundtrip(const char *name, long iterations)
+{
+    struct ring_channel *chan;
+    struct mesg_buf msg;
+    unsigned int seq = 0;
+    long i;
+    long long start;
+    pid_t pid;
+
+    chan = mmap(NULL, sizeof(struct ring_channel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (chan == MAP_FAILED)
+    {
+        perror("bench mmap");
+        return;
+    }
+    ring_reset(chan);
+    memset(&msg, 0, sizeof(msg));
+
+    fflush(stdout);
+    if ((pid = fork()) == 0)
+    {
+        for (i = 0; i < iterations; i++)
+        {
+            while (!ring_pop(&chan->requests, &msg))
+            {
+                sched_yield();
+            }
+            ring_reply(chan, &msg);
+        }
+        _exit(0);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        msg.items[0].resource = (int)i;
+        ring_push(&chan->requests, &msg);
+        seq = ring_await_reply(chan, seq, &msg);
+    }
+    report(name, iterations, now_ns() - start);
+
+    waitpid(pid, NULL, 0);
+    munmap(chan, sizeof(struct ring_channel));
+}
+
+
+// Advances a shared clock from nprocs processes at once, iterations times each. With locked set, the clock is the
+// old sec/nsec pair behind a named semaphore; otherwise it is the 64-bit counter advanced with advanceClock.
+static void bench_clock_contention(int nprocs, long iterations, int locked)
+{
+    struct shared {
+        struct clock pair;
+        uint64_t ns;
+    } *shared;
+    sem_t *sem = NULL;
+    char name[64];
+    long i;
+    int p;
+    long long start;
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("bench mmap");
+        return;
+    }
+    memset(shared, 0, sizeof(*shared));
+    if (locked)
+    {
+        sem_unlink(BENCH_SEM_NAME);
+        if ((sem = sem_open(BENCH_SEM_NAME, O_CREAT, 0600, 1)) == SEM_FAILED)
+        {
+            perror("bench sem_open");
+            return;
+        }
+    }
+
+    fflush(stdout);
+    start = now_ns();
+    for (p = 0; p < nprocs; p++)
+    {
+        if (fork() == 0)
+        {
+            for (i = 0; i < iterations; i++)
+            {
+                if (locked)
+                {
+                    sem_wait(sem);
+                    if ((shared->pair.nsec + WORKCONSTANT) >= BILLION)
+                    {
+                        shared->pair.sec++;
+                        shared->pair.nsec = shared->pair.nsec + WORKCONSTANT - BILLION;
+                    }
+                    else
+                    {
+                        shared->pair.nsec += WORKCONSTANT;
+                    }
+                    sem_post(sem);
+                }
+                else
+                {
+                    advanceClock(&shared->ns, WORKCONSTANT);
+                }
+            }
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+    {
+    }
+    sprintf(name, "clock/%s/%dproc", locked ? "semaphore" : "atomic", nprocs);
+    report(name, iterations * nprocs, now_ns() - start);
+
+    if (locked)
+    {
+        sem_close(sem);
+        sem_unlink(BENCH_SEM_NAME);
+    }
+    munmap(shared, sizeof(*shared));
+}
+
+
+// Each of nprocs processes increments its own counter in a shared table iterations times, with rows stride
+// ints apart. Rows of a bare 20-int claim table straddle cache lines, so neighbouring processes write the
+// same lines; rows padded with ROW_STRIDE never do.
+static void bench_row_sharing(int nprocs, long iterations, int stride)
+{
+    int *table;
+    size_t size = (size_t)(nprocs + 1) * stride * sizeof(int);
+    char name[64];
+    long i;
+    int p;
+    long long start;
+
+    table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+    {
+        perror("bench mmap");
+        return;
+    }
+
+    fflush(stdout);
+    start = now_ns();
+    for (p = 1; p <= nprocs; p++)
+    {
+        if (fork() == 0)
+        {
+            volatile int *row = table + (size_t)p * stride;
+            for (i = 0; i < iterations; i++)
+            {
+                row[i % BENCH_RESOURCES]++;
+            }
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+    {
+    }
+    sprintf(name, "table/%s/%dproc", stride == BENCH_RESOURCES ? "packed" : "aligned", nprocs);
+    report(name, iterations * nprocs, now_ns() - start);
+    munmap(table, size);
+}
+
+
+// Builds a random safe state with nprocs active processes and measures the Banker's safety check on it:
+// the incremental test against the cached safe sequence that a typical grant takes, and the full search it
+// falls back to when that sequence breaks. The full search is O(n^2 m), so it runs fewer times as n grows.
+static void bench_safety_check(int nprocs, long iterations)
+{
+    struct resource_manager rm;
+    struct batch_item item = {0, 1};
+    int total[BENCH_RESOURCES];
+    int *max;
+    char name[64];
+    long i, full_iterations;
+    long long start;
+    int p, r, safe = 0;
+
+    srand(nprocs);
+    for (r = 0; r < BENCH_RESOURCES; r++)
+    {
+        total[r] = (rand() % 10) + 1;
+    }
+    max = calloc((size_t)(nprocs + 1) * ROW_STRIDE(BENCH_RESOURCES), sizeof(int));
+    if (max == NULL || rm_init(&rm, nprocs, BENCH_RESOURCES, total, max) == -1)
+    {
+        perror("bench rm_init");
+        return;
+    }
+    for (p = 1; p <= nprocs; p++)
+    {
+        for (r = 0; r < BENCH_RESOURCES; r++)
+        {
+            RM_ROW(&rm, max, p)[r] = rand() % 3;
+        }
+        rm_admit(&rm, p);
+    }
+    // hand out resources through the manager itself so the state stays safe
+    for (i = 0; i < nprocs * BENCH_RESOURCES / 2; i++)
+    {
+        item.resource = rand() % BENCH_RESOURCES;
+        rm_try_grant(&rm, (rand() % nprocs) + 1, &item, 1);
+    }
+    if (!json)
+    {
+        printf("%-32s %10.1f%% of %ld grants kept the cached sequence\n", "", 100.0 * rm.fast_checks /
+               (rm.fast_checks + rm.full_checks), rm.fast_checks + rm.full_checks);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        item.resource = i % BENCH_RESOURCES;
+        safe += rm_sequence_allows(&rm, (i % nprocs) + 1, &item, 1);
+    }
+    sprintf(name, "safety/incremental/%dproc/%dres", nprocs, BENCH_RESOURCES);
+    report(name, iterations, now_ns() - start);
+
+    full_iterations = nprocs > 18 ? iterations * 18 / nprocs / nprocs + 1 : iterations;
+    start = now_ns();
+    for (i = 0; i < full_iterations; i++)
+    {
+        safe += rm_full_safety_check(&rm);
+    }
+    sprintf(name, "safety/full/%dproc/%dres", nprocs, BENCH_RESOURCES);
+    report(name, full_iterations, now_ns() - start);
+    sink = safe;
+    rm_free(&rm);
+    free(max);
+}
+
+
+// Blocks a request behind nprocs - 1 waiters spread over the resources' wait queues and takes it out again, as
+// a block and a deadlock victim do, and retries every waiter with nothing free, as a release that wakes no one
+// does. Under policy the queues are heaps on each waiter's key.
+static void bench_wait_queue(int nprocs, int policy, long iterations)
+{
+    struct resource_manager rm;
+    struct mesg_buf msg;
+    struct mesg_buf granted;
+    int total[BENCH_RESOURCES];
+    int *max;
+    char name[64];
+    long i, woken = 0;
+    long long start;
+    int p, r;
+    const char *policies[] = {"fifo", "srcf", "aging", "fair"};
+
+    srand(nprocs);
+    for (r = 0; r < BENCH_RESOURCES; r++)
+    {
+        total[r] = 3;
+    }
+    max = calloc((size_t)(nprocs + 1) * ROW_STRIDE(BENCH_RESOURCES), sizeof(int));
+    if (max == NULL || rm_init(&rm, nprocs, BENCH_RESOURCES, total, max) == -1)
+    {
+        perror("bench rm_init");
+        return;
+    }
+    // every instance is out, held by no one the benchmark knows about, so every request waits
+    memset(rm.available, 0, BENCH_RESOURCES * sizeof(int));
+    rm.detection = 1;
+    rm.grant_policy = policy;
+    memset(&msg, 0, sizeof(msg));
+    msg.opcode = REQUEST;
+    msg.nitems = 1;
+    msg.items[0].count = 1;
+    for (p = 1; p <= nprocs; p++)
+    {
+        for (r = 0; r < BENCH_RESOURCES; r++)
+        {
+            RM_ROW(&rm, max, p)[r] = 1 + rand() % 3;
+        }
+        rm_admit(&rm, p);
+        if (p < nprocs)
+        {
+            msg.simpid = p;
+            msg.timestamp = rand();
+            msg.items[0].resource = rand() % BENCH_RESOURCES;
+            rm_request(&rm, &msg);
+        }
+    }
+
+    msg.simpid = nprocs;
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        msg.timestamp = rand();
+        msg.items[0].resource = i % BENCH_RESOURCES;
+        rm_request(&rm, &msg);
+        rm_cancel_wait(&rm, nprocs);
+    }
+    sprintf(name, "waitq/%s/block+cancel/%dproc", policies[policy], nprocs);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations / nprocs + 1; i++)
+    {
+        rm.epoch++;
+        woken += rm_wake(&rm, &granted);
+    }
+    sprintf(name, "waitq/%s/wake_none/%dproc", policies[policy], nprocs);
+    report(name, iterations / nprocs + 1, now_ns() - start);
+    sink = woken + bit_count(rm.blocked, rm.procwords);
+    rm_free(&rm);
+    free(max);
+}
+
+
+// One thread of bench_shards: grants and releases single instances in its own shard under the shard's lock,
+// the way a shard thread of OSS does, and every spanning'th request takes the next shard's lock as well
+struct shard_worker {
+    struct shard_set *set;
+    int shard;
+    int spanning;
+    long iterations;
+    pthread_t thread;
+};
+
+static void *bench_shard_worker(void *arg)
+{
+    struct shard_worker *w = arg;
+    struct shard *sh = &w->set->shards[w->shard];
+    struct shard *next = &w->set->shards[w->shard + 1];
+    struct batch_item item = {0, 1};
+    int simpid = w->shard + 1;
+    long i;
+
+    for (i = 0; i < w->iterations; i++)
+    {
+        item.resource = i % sh->rm.nresources;
+        pthread_mutex_lock(&sh->lock);
+        rm_try_grant(&sh->rm, simpid, &item, 1);
+        if (w->spanning && i % w->spanning == 0 && w->shard + 1 < w->set->nshards)
+        {
+            pthread_mutex_lock(&next->lock);
+            rm_try_grant(&next->rm, simpid, &item, 1);
+            rm_release(&next->rm, simpid, item.resource, 1);
+            pthread_mutex_unlock(&next->lock);
+        }
+        rm_release(&sh->rm, simpid, item.resource, 1);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return NULL;
+}
+
+
+// Splits BENCH_RESOURCES * 4 resource classes into nshards shards and runs a thread on each, granting and
+// releasing as fast as it can, with one request in spanning (0 for none) also taking the next shard.
+// Reports grants per second over all the threads: how the sharded manager of OSS -k scales with cores.
+static void bench_shards(int nshards, int spanning, long iterations)
+{
+    struct shard_set set;
+    struct shard_worker workers[MAX_SHARDS];
+    int nresources = BENCH_RESOURCES * 4;
+    int total[nresources];
+    int claims[nresources];
+    char name[64];
+    long long start;
+    int s, r;
+
+    for (r = 0; r < nresources; r++)
+    {
+        total[r] = 1 << 20;
+        claims[r] = 1 << 20;
+    }
+    if (shard_set_init(&set, nshards, nshards, nresources, total, GRANT_FIFO) == -1)
+    {
+        perror("bench shard_set_init");
+        return;
+    }
+    for (s = 1; s <= nshards; s++)
+    {
+        shard_admit(&set, s, claims);
+    }
+    start = now_ns();
+    for (s = 0; s < nshards; s++)
+    {
+        workers[s].set = &set;
+        workers[s].shard = s;
+        workers[s].spanning = spanning;
+        workers[s].iterations = iterations / nshards;
+        pthread_create(&workers[s].thread, NULL, bench_shard_worker, &workers[s]);
+    }
+    for (s = 0; s < nshards; s++)
+    {
+        pthread_join(workers[s].thread, NULL);
+    }
+    sprintf(name, "shards/%d%s", nshards, spanning ? "/spanning" : "");
+    report(name, iterations / nshards * nshards, now_ns() - start);
+    shard_set_free(&set);
+}
+
+
+// Runs every row kernel of the named set over rows of nresources resources, padded to a stride the way the
+// process table pads them. fits is given rows that pass, so it scans the whole row.
+static void bench_row_kernels(const char *set, int nresources, long iterations)
+{
+    const struct row_ops *ops = rowops_find(set);
+    int stride = ROW_STRIDE(nresources);
+    int *max, *allocation, *work;
+    char name[64];
+    long i, total = 0;
+    long long start;
+    int r;
+
+    if (ops == NULL)
+    {
+        if (!json)
+        {
+            printf("%-32s not supported on this CPU\n", set);
+        }
+        return;
+    }
+    if (posix_memalign((void **)&max, CACHELINE, stride * sizeof(int)) != 0 ||
+        posix_memalign((void **)&allocation, CACHELINE, stride * sizeof(int)) != 0 ||
+        posix_memalign((void **)&work, CACHELINE, stride * sizeof(int)) != 0)
+    {
+        perror("bench posix_memalign");
+        return;
+    }
+    memset(max, 0, stride * sizeof(int));
+    memset(allocation, 0, stride * sizeof(int));
+    memset(work, 0, stride * sizeof(int));
+    for (r = 0; r < nresources; r++)
+    {
+        max[r] = (rand() % 3) + 1;
+        allocation[r] = rand() % max[r];
+        work[r] = max[r];
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        total += ops->fits(max, allocation, work, stride);
+    }
+    sprintf(name, "rowops/%s/fits/%dres", ops->name, nresources);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        ops->add(work, allocation, stride);
+    }
+    sprintf(name, "rowops/%s/add/%dres", ops->name, nresources);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        ops->clamp(work, max, stride);
+    }
+    sprintf(name, "rowops/%s/clamp/%dres", ops->name, nresources);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        total += ops->sum(allocation, stride);
+    }
+    sprintf(name, "rowops/%s/sum/%dres", ops->name, nresources);
+    report(name, iterations, now_ns() - start);
+
+    sink = total;
+    free(max);
+    free(allocation);
+    free(work);
+}
+
+
+// Hands out and frees a simpid with every other simpid but the highest already taken, the worst case for
+// both the old linear scan over the process table and the bitmap allocator that replaced it
+static void bench_simpid_alloc(int nprocs, long iterations)
+{
+    struct slot_allocator slots;
+    int *procarray = calloc(nprocs + 1, sizeof(int));
+    char name[64];
+    long i, total = 0;
+    long long start;
+    int s;
+
+    if (procarray == NULL || slot_init(&slots, nprocs) == -1)
+    {
+        perror("bench slot_init");
+        return;
+    }
+    for (s = 1; s < nprocs; s++)
+    {
+        procarray[s] = 1;
+        slot_alloc(&slots);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        for (s = 1; s <= nprocs && procarray[s] != 0; s++)
+        {
+        }
+        procarray[s] = 1;
+        total += s;
+        procarray[s] = 0;
+    }
+    sprintf(name, "simpid/linear/%dproc", nprocs);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        s = slot_alloc(&slots);
+        total += s;
+        slot_free(&slots, s);
+    }
+    sprintf(name, "simpid/bitmap/%dproc", nprocs);
+    report(name, iterations, now_ns() - start);
+
+    sink = total;
+    slot_destroy(&slots);
+    free(procarray);
+}
+
+
+// Records spread-out latencies the way the master records every grant: a global histogram and a per-simpid one
+static void bench_histogram(long iterations)
+{
+    struct histogram *global = malloc(sizeof(struct histogram));
+    struct histogram *simpid = malloc(19 * sizeof(struct histogram));
+    long long start;
+    uint64_t v = 1;
+    long i;
+
+    if (global == NULL || simpid == NULL)
+    {
+        perror("bench malloc");
+        return;
+    }
+    hist_init(global);
+    for (i = 0; i < 19; i++)
+    {
+        hist_init(&simpid[i]);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+        hist_record(global, v >> 40);
+        hist_record(&simpid[1 + i % 18], v >> 40);
+    }
+    report("histogram/record2", iterations, now_ns() - start);
+    sink = hist_quantile(global, 0.99);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        sink += now_ns();
+    }
+    report("histogram/clock_gettime", iterations, now_ns() - start);
+    free(global);
+    free(simpid);
+}
+
+
+// Picks an eligible resource out of nresources with only eligible of them eligible, by drawing until one is
+// eligible as users used to, and by a popcount and select over a bitset of the eligible ones
+static void bench_choose_resource(int nresources, int eligible, long iterations)
+{
+    int current[nresources];
+    uint64_t bits[BITWORDS(nresources)];
+    struct prng rng;
+    char name[64];
+    long long start;
+    long i, total = 0;
+    int r;
+
+    prng_init(&rng, 1, 0);
+    memset(bits, 0, sizeof(bits));
+    for (r = 0; r < nresources; r++)
+    {
+        current[r] = r % (nresources / eligible) == 0 && r / (nresources / eligible) < eligible;
+        if (current[r])
+        {
+            bit_set(bits, r);
+        }
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        do
+        {
+            r = prng_below(&rng, nresources);
+        } while (!current[r]);
+        total += r;
+    }
+    sprintf(name, "choose/rejection/%dof%d", eligible, nresources);
+    report(name, iterations, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        total += bit_select(bits, BITWORDS(nresources), prng_below(&rng, bit_count(bits, BITWORDS(nresources))));
+    }
+    sprintf(name, "choose/bitset/%dof%d", eligible, nresources);
+    report(name, iterations, now_ns() - start);
+    sink = total;
+}
+
+
+// The hold model for the discrete-event mode's future events: with pending events queued, take the earliest
+// and schedule the next one a random time later, as every step of the simulation does
+static void bench_event_queue(int pending, long iterations)
+{
+    struct event_queue q;
+    struct sim_event ev = {0, 0, 0, 0, 0};
+    struct prng rng;
+    char name[64];
+    long long start;
+    long i;
+
+    prng_init(&rng, 1, 0);
+    if (event_queue_init(&q, pending) == -1)
+    {
+        perror("bench event_queue_init");
+        return;
+    }
+    for (i = 0; i < pending; i++)
+    {
+        event_push(&q, prng_below(&rng, WORKCONSTANT), EVENT_STEP, i + 1, 0);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        event_pop(&q, &ev);
+        event_push(&q, ev.time + prng_below(&rng, WORKCONSTANT), ev.kind, ev.simpid, ev.generation);
+    }
+    sprintf(name, "events/hold/%dpending", pending);
+    report(name, iterations, now_ns() - start);
+    sink = ev.time;
+    event_queue_free(&q);
+}
+
+
+// The number after "key": in the JSON text, looking only past the start of "object": if object isn't NULL.
+// Returns 0 if either isn't there. The metrics file OSS writes has no key repeated within an object.
+static double json_number(const char *text, const char *object, const char *key)
+{
+    char pattern[64];
+    const char *at = text;
+
+    if (object != NULL)
+    {
+        snprintf(pattern, sizeof(pattern), "\"%s\":", object);
+        if ((at = strstr(text, pattern)) == NULL)
+        {
+            return 0;
+        }
+    }
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if ((at = strstr(at, pattern)) == NULL)
+    {
+        return 0;
+    }
+    return strtod(at + strlen(pattern), NULL);
+}
+
+
+// Reads a whole file into a string the caller frees, or returns NULL
+static char *read_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char *text = NULL;
+    long size;
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+        (text = malloc(size + 1)) != NULL)
+    {
+        text[fread(text, 1, size, fp)] = '\0';
+    }
+    fclose(fp);
+    return text;
+}
+
+
+// Prints the percentiles of one of the metrics file's histograms as a JSON object
+static void print_percentiles(const char *metrics, const char *histogram)
+{
+    printf("{\"count\": %.0f, \"p50\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}",
+           json_number(metrics, histogram, "count"), json_number(metrics, histogram, "p50"),
+           json_number(metrics, histogram, "p99"), json_number(metrics, histogram, "p999"),
+           json_number(metrics, histogram, "max"));
+}
+
+
+// Runs oss through one scenario with the given seed and prints what it did as a JSON line. OSS signals its
+// whole process group as it exits, so it gets a session of its own. Returns 0, or -1 if it failed.
+static int run_scenario(const struct scenario *sc, const char *oss, uint64_t seed, const char *commit)
+{
+    char options[256], strprocs[12], strresources[12], strterminate[12], strskew[32], strseconds[12], strseed[24];
+    char logpath[64], metricspath[64];
+    char *argv[64];
+    char *metrics, *token;
+    struct rusage usage;
+    long long start, wall;
+    double cpu_ns, run_wall;
+    int argc = 0, status, fd;
+    pid_t pid;
+
+    snprintf(logpath, sizeof(logpath), "/tmp/bench-oss-%d.log", (int)getpid());
+    snprintf(metricspath, sizeof(metricspath), "/tmp/bench-oss-%d.json", (int)getpid());
+    snprintf(strprocs, sizeof(strprocs), "%d", sc->procs);
+    snprintf(strresources, sizeof(strresources), "%d", sc->resources);
+    snprintf(strterminate, sizeof(strterminate), "%d", sc->terminate);
+    snprintf(strskew, sizeof(strskew), "%g", sc->skew);
+    snprintf(strseconds, sizeof(strseconds), "%d", sc->seconds);
+    snprintf(strseed, sizeof(strseed), "%llu", (unsigned long long)seed);
+    snprintf(options, sizeof(options), "%s", sc->options);
+    argv[argc++] = (char *)oss;
+    argv[argc++] = "-l";
+    argv[argc++] = logpath;
+    argv[argc++] = "-m";
+    argv[argc++] = metricspath;
+    argv[argc++] = "-t";
+    argv[argc++] = SCENARIO_WALL_LIMIT;
+    argv[argc++] = "-S";
+    argv[argc++] = strseed;
+    argv[argc++] = "-s";
+    argv[argc++] = strprocs;
+    argv[argc++] = "-n";
+    argv[argc++] = strresources;
+    argv[argc++] = "-x";
+    argv[argc++] = strterminate;
+    argv[argc++] = "-z";
+    argv[argc++] = strskew;
+    argv[argc++] = "-T";
+    argv[argc++] = strseconds;
+    for (token = strtok(options, " "); token != NULL && argc < 63; token = strtok(NULL, " "))
+    {
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+    unlink(metricspath);
+
+    start = now_ns();
+    if ((pid = fork()) == -1)
+    {
+        perror("bench fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        setsid();
+        if ((fd = open("/dev/null", O_WRONLY)) != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execv(oss, argv);
+        _exit(127);
+    }
+    // the users OSS forks are reaped by OSS, so the rusage of the wait covers the whole run
+    if (wait4(pid, &status, 0, &usage) == -1)
+    {
+        perror("bench wait4");
+        return -1;
+    }
+    wall = now_ns() - start;
+    unlink(logpath);
+
+    metrics = read_file(metricspath);
+    run_wall = metrics != NULL ? json_number(metrics, "run", "wall_ns") : 0;
+    cpu_ns = metrics != NULL ? json_number(metrics, "run", "cpu_ns") : 0;
+    printf("{\"scenario\": \"%s\", \"commit\": \"%s\", \"seed\": %llu, \"procs\": %d, \"resources\": %d, "
+           "\"terminate\": %d, \"skew\": %g, \"sim_seconds\": %d, \"options\": \"%s\", \"exit\": %d, ",
+           sc->name, commit, (unsigned long long)seed, sc->procs, sc->resources, sc->terminate, sc->skew,
+           sc->seconds, sc->options, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    if (metrics == NULL)
+    {
+        printf("\"wall_ns\": %lld}\n", wall);
+        return -1;
+    }
+    printf("\"wall_ns\": %lld, \"requests_per_sec\": %.0f, \"grants_per_sec\": %.0f, \"master_cpu_pct\": %.1f, "
+           "\"grants\": %.0f, \"blocks\": %.0f, \"wait_sim_ns\": ", wall,
+           json_number(metrics, "run", "requests_per_sec"), json_number(metrics, "run", "grants_per_sec"),
+           run_wall > 0 ? 100.0 * cpu_ns / run_wall : 0.0, json_number(metrics, "counters", "grants"),
+           json_number(metrics, "counters", "blocks"));
+    print_percentiles(metrics, "wait_sim_ns");
+    printf(", \"blocked_sim_ns\": ");
+    print_percentiles(metrics, "blocked_sim_ns");
+    printf(", \"master_peak_rss_kb\": %.0f, \"peak_rss_kb\": %ld}\n", json_number(metrics, "run", "peak_rss_kb"),
+           usage.ru_maxrss);
+    fflush(stdout);
+    free(metrics);
+    unlink(metricspath);
+    return 0;
+}
+
+
+// The commit the tree was built from, for telling results apart, or "unknown" outside a git checkout
+static void current_commit(char *commit, size_t size)
+{
+    FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+
+    snprintf(commit, size, "unknown");
+    if (git != NULL)
+    {
+        if (fgets(commit, size, git) == NULL)
+        {
+            snprintf(commit, size, "unknown");
+        }
+        commit[strcspn(commit, "\n")] = '\0';
+        pclose(git);
+    }
+}
+
+
+// Runs the named scenario, or all of them, runs times each with seeds 1 to runs, with whatever the command line
+// overrides. Returns the number of runs that failed.
+static int run_scenarios(const char *which, const struct scenario *overrides, const char *oss, int runs)
+{
+    struct scenario sc;
+    char commit[64];
+    int i, run, failed = 0, found = 0;
+
+    current_commit(commit, sizeof(commit));
+    for (i = 0; i < NSCENARIOS; i++)
+    {
+        if (strcmp(which, "all") != 0 && strcmp(which, scenarios[i].name) != 0)
+        {
+            continue;
+        }
+        found = 1;
+        sc = scenarios[i];
+        sc.procs = overrides->procs > 0 ? overrides->procs : sc.procs;
+        sc.resources = overrides->resources > 0 ? overrides->resources : sc.resources;
+        sc.terminate = overrides->terminate >= 0 ? overrides->terminate : sc.terminate;
+        sc.skew = overrides->skew >= 0 ? overrides->skew : sc.skew;
+        sc.seconds = overrides->seconds > 0 ? overrides->seconds : sc.seconds;
+        sc.options = overrides->options != NULL ? overrides->options : sc.options;
+        for (run = 1; run <= runs; run++)
+        {
+            failed += run_scenario(&sc, oss, run, commit) == -1;
+        }
+    }
+    if (!found)
+    {
+        fprintf(stderr, "Error, there is no scenario %s!\n", which);
+        return 1;
+    }
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    long iterations = DEFAULT_ITERATIONS;
+    struct text_mesg_buf text;
+    struct mesg_buf binary;
+    struct scenario overrides = {NULL, 0, 0, -1, -1, 0, NULL};
+    const char *sets[] = {"scalar", "sse2", "avx2"};
+    const char *scenario = NULL;
+    const char *oss = "./oss";
+    int runs = 1;
+    size_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "jc:r:o:s:n:x:z:T:a:")) != -1)
+    {
+        switch (c)
+        {
+            case 'j':
+                json = 1;
+                break;
+            case 'c':
+                scenario = optarg;
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'o':
+                oss = optarg;
+                break;
+            case 's':
+                overrides.procs = atoi(optarg);
+                break;
+            case 'n':
+                overrides.resources = atoi(optarg);
+                break;
+            case 'x':
+                overrides.terminate = atoi(optarg);
+                break;
+            case 'z':
+                overrides.skew = atof(optarg);
+                break;
+            case 'T':
+                overrides.seconds = atoi(optarg);
+                break;
+            case 'a':
+                overrides.options = optarg;
+                break;
+            default:
+                printf("Usage: ./bench [-j] [iterations]\n");
+                printf("       ./bench -c scenario|all [-r runs] [-o oss] [-s procs] [-n resources] [-x chance] "
+                       "[-z skew] [-T secs] [-a \"oss options\"]\n");
+                printf("Scenarios:");
+                for (c = 0; c < NSCENARIOS; c++)
+                {
+                    printf(" %s", scenarios[c].name);
+                }
+                printf("\n");
+                return 1;
+        }
+    }
+    if (scenario != NULL)
+    {
+        if (runs <= 0)
+        {
+            printf("Error, runs must be a positive integer!\n");
+            return 1;
+        }
+        return run_scenarios(scenario, &overrides, oss, runs) == 0 ? 0 : 1;
+    }
+    if (optind < argc)
+    {
+        iterations = atol(argv[optind]);
+    }
+    if (iterations <= 0)
+    {
+        printf("Error, iterations must be a positive integer!\n");
+        return 1;
+    }
+
+    memset(&text, 0, sizeof(text));
+    memset(&binary, 0, sizeof(binary));
+
+    bench_text_codec(iterations);
+    bench_binary_codec(iterations);
+    bench_queue_roundtrip("msgqueue/text", iterations / 10, &text, sizeof(text.mtext));
+    bench_queue_roundtrip("msgqueue/binary", iterations / 10, &binary, MSG_BYTES(1));
+    bench_queue_roundtrip("msgqueue/batch8", iterations / 10, &binary, MSG_BYTES(MAXBATCH));
+    bench_ring_roundtrip("ring/binary", iterations / 10);
+    bench_clock_contention(1, iterations, 1);
+    bench_clock_contention(1, iterations, 0);
+    bench_clock_contention(4, iterations / 4, 1);
+    bench_clock_contention(4, iterations / 4, 0);
+    bench_clock_contention(17, iterations / 17, 1);
+    bench_clock_contention(17, iterations / 17, 0);
+    bench_safety_check(1, iterations);
+    bench_safety_check(4, iterations);
+    bench_safety_check(9, iterations);
+    bench_safety_check(18, iterations);
+    bench_safety_check(64, iterations);
+    bench_safety_check(256, iterations);
+    bench_safety_check(1024, iterations);
+    bench_wait_queue(18, GRANT_FIFO, iterations);
+    bench_wait_queue(18, GRANT_SRCF, iterations);
+    bench_wait_queue(256, GRANT_FIFO, iterations);
+    bench_wait_queue(256, GRANT_SRCF, iterations);
+    bench_wait_queue(1024, GRANT_AGING, iterations);
+    bench_shards(1, 0, iterations);
+    bench_shards(2, 0, iterations);
+    bench_shards(4, 0, iterations);
+    bench_shards(8, 0, iterations);
+    bench_shards(4, 8, iterations);
+    bench_shards(8, 8, iterations);
+    bench_row_sharing(4, iterations, BENCH_RESOURCES);
+    bench_row_sharing(4, iterations, ROW_STRIDE(BENCH_RESOURCES));
+    bench_row_sharing(17, iterations / 4, BENCH_RESOURCES);
+    bench_row_sharing(17, iterations / 4, ROW_STRIDE(BENCH_RESOURCES));
+    bench_simpid_alloc(18, iterations);
+    bench_simpid_alloc(1024, iterations);
+    bench_simpid_alloc(4096, iterations / 4);
+    bench_histogram(iterations);
+    bench_choose_resource(20, 1, iterations);
+    bench_choose_resource(20, 10, iterations);
+    bench_choose_resource(256, 1, iterations / 10);
+    bench_event_queue(16, iterations);
+    bench_event_queue(64, iterations);
+    bench_event_queue(1024, iterations);
+    for (i = 0; i < sizeof(sets) / sizeof(sets[0]); i++)
+    {
+        bench_row_kernels(sets[i], 20, iterations);
+        bench_row_kernels(sets[i], 64, iterations);
+        bench_row_kernels(sets[i], 256, iterations / 4);
+        bench_row_kernels(sets[i], 1024, iterations / 16);
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Fixed-size bitsets over 64-bit words, used for sets of simpids in the master and sets of resources in users.
+ */
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define BITWORDS(nbits) (((nbits) + 63) / 64)
+
+
+static inline void bit_set(uint64_t *bits, int i)
+{
+    bits[i / 64] |= 1ULL << (i % 64);
+}
+
+
+static inline void bit_clear(uint64_t *bits, int i)
+{
+    bits[i / 64] &= ~(1ULL << (i % 64));
+}
+
+
+static inline int bit_test(const uint64_t *bits, int i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+
+// Returns the number of bits set in the first nwords words
+static inline int bit_count(const uint64_t *bits, int nwords)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nwords; i++)
+    {
+        n += __builtin_popcountll(bits[i]);
+    }
+    return n;
+}
+
+
+// Returns the lowest set bit at or after start, or -1 if there is none in the first nwords words
+static inline int bit_next(const uint64_t *bits, int nwords, int start)
+{
+    int w = start / 64;
+    uint64_t word;
+
+    if (w >= nwords)
+    {
+        return -1;
+    }
+    word = bits[w] & (~0ULL << (start % 64));
+    while (!word)
+    {
+        if (++w >= nwords)
+        {
+            return -1;
+        }
+        word = bits[w];
+    }
+    return w * 64 + __builtin_ctzll(word);
+}
+
+
+// Returns the position of the set bit with k set bits below it in the first nwords words, or -1 if there are
+// no more than k bits set. Whole words are skipped by popcount, then the k lower bits in the word are cleared.
+static inline int bit_select(const uint64_t *bits, int nwords, int k)
+{
+    uint64_t word;
+    int w, n;
+
+    for (w = 0; w < nwords; w++)
+    {
+        n = __builtin_popcountll(bits[w]);
+        if (k < n)
+        {
+            break;
+        }
+        k -= n;
+    }
+    if (w == nwords)
+    {
+        return -1;
+    }
+    for (word = bits[w]; k > 0; k--)
+    {
+        word &= word - 1;
+    }
+    return w * 64 + __builtin_ctzll(word);
+}
+
+#endif
@@ -2,10 +2,54 @@
  * Joshua Bearden
  * CS4760 Project 3
  *
- * A file that contains a struct for use with OSS and User
+ * A file that contains the simulated clock for use with OSS and User.
+ *
+ * The shared clock is a single 64-bit count of nanoseconds. It is advanced with an atomic fetch-add and read
+ * with an atomic load, so no process ever has to lock it. struct clock is the sec/nsec form used for logging.
  */
 
+#ifndef CLOCK_C
+#define CLOCK_C
+
+#include <stdint.h>
+
+#define CLOCK_BILLION 1000000000ULL
+
 struct clock {
     int sec;
     int nsec;
-};
\ No newline at end of file
+};
+
+
+// Reads the shared clock
+static inline uint64_t readClock(uint64_t *clock)
+{
+    return __atomic_load_n(clock, __ATOMIC_ACQUIRE);
+}
+
+
+// Advances the shared clock by nsecs nanoseconds and returns the new time
+static inline uint64_t advanceClock(uint64_t *clock, uint64_t nsecs)
+{
+    return __atomic_add_fetch(clock, nsecs, __ATOMIC_ACQ_REL);
+}
+
+
+// Splits a time in nanoseconds into seconds and nanoseconds for printing
+static inline struct clock splitClock(uint64_t ns)
+{
+    struct clock c;
+
+    c.sec = (int)(ns / CLOCK_BILLION);
+    c.nsec = (int)(ns % CLOCK_BILLION);
+    return c;
+}
+
+
+// Builds a time in nanoseconds from seconds and nanoseconds
+static inline uint64_t joinClock(int sec, int nsec)
+{
+    return (uint64_t)sec * CLOCK_BILLION + nsec;
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The plumbing of OSS's simulation engine (-e). Instead of forking a user for every process, the master runs
+ * the processes itself, as the state machines of behavior.h, on a few engine threads of its own. Each thread
+ * owns every nworkers'th simpid and steps its running processes in turn. A message a process sends goes to
+ * the master over its thread's requests queue, and the master's replies, launches and kills come back over
+ * the thread's commands queue, so no message ever passes through the kernel and no process is ever forked.
+ * The master loop itself is unchanged: it still receives, decides and replies, only through these queues.
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "message.h"
+#include "proctable.h"
+#include "behavior.h"
+#include "pipeline.h"
+
+#define MAX_ENGINE_THREADS 16
+
+// What the master sends an engine thread
+#define ENGINE_LAUNCH 1         // start a process as simpid
+#define ENGINE_REPLY 2          // the answer to simpid's message
+#define ENGINE_KILL 3           // simpid's process is a deadlock victim
+
+// What a simpid's task is doing
+enum {
+    ENGINE_IDLE,                // no process running as the simpid
+    ENGINE_RUNNABLE,            // stepped on every turn of its thread
+    ENGINE_WAITING              // sent a message, waiting for the reply
+};
+
+// The simpid's thread in a set of nworkers
+#define ENGINE_WORKER(e, simpid) (((simpid) - 1) % (e)->nworkers)
+
+struct engine_command {
+    int kind;
+    int simpid;
+    unsigned int generation;    // for ENGINE_LAUNCH
+    int pid;                    // the process's stand-in pid, for ENGINE_LAUNCH
+    struct mesg_buf msg;        // for ENGINE_REPLY
+};
+
+// A message on its way to the master, with the wall time it was sent
+struct engine_request {
+    struct mesg_buf msg;
+    long long at;
+};
+
+struct engine_task {
+    struct sim_process proc;
+    int state;
+};
+
+struct engine_worker {
+    struct spsc_queue commands;         // master -> thread
+    struct spsc_queue requests;         // thread -> master
+    struct bell bell;                   // rung by the master
+    int first;                          // its lowest simpid
+    long steps;                         // sim_step calls it has made
+    pthread_t thread;
+} __attribute__((aligned(CACHELINE)));
+
+struct engine {
+    int nworkers;
+    int done;                           // set when the run is over, every thread exits
+    int nprocs;
+    int serial;                         // tasks have no pid, each process gets the next serial number instead
+    int next;                           // the requests queue the master looks at first
+    struct engine_worker *workers;
+    struct engine_task *tasks;          // indexed by simpid
+    struct proc_table *table;
+    uint64_t *clock;
+    struct master_ctl *ctl;             // rung like the users ring it, for a message or passing the next fork
+};
+
+
+// Sets up nworkers threads' queues and a task for each of table's simpids, choosing resources with the Zipf
+// weights zipf_cum. Returns 0, or -1 if something can't be allocated.
+static inline int engine_init(struct engine *e, int nworkers, struct proc_table *table, const double *zipf_cum,
+                              uint64_t *clock, struct master_ctl *ctl)
+{
+    struct engine_worker *w;
+    int i;
+
+    memset(e, 0, sizeof(*e));
+    e->nworkers = nworkers;
+    e->nprocs = table->nprocs;
+    e->table = table;
+    e->clock = clock;
+    e->ctl = ctl;
+    e->tasks = calloc(table->nprocs + 1, sizeof(struct engine_task));
+    if (e->tasks == NULL ||
+        posix_memalign((void **)&e->workers, CACHELINE, nworkers * sizeof(struct engine_worker)) != 0)
+    {
+        return -1;
+    }
+    memset(e->workers, 0, nworkers * sizeof(struct engine_worker));
+    for (i = 1; i <= table->nprocs; i++)
+    {
+        if (sim_init(&e->tasks[i].proc, table, zipf_cum, clock) == -1)
+        {
+            return -1;
+        }
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+        w = &e->workers[i];
+        w->first = i + 1;
+        // a simpid has at most one message on its way to the master, and at most a reply, a kill and a
+        // launch on their way back
+        if (spsc_init(&w->commands, 4 * (table->nprocs + 1), sizeof(struct engine_command)) == -1 ||
+            spsc_init(&w->requests, table->nprocs + 1, sizeof(struct engine_request)) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static inline void engine_free(struct engine *e)
+{
+    int i;
+
+    for (i = 1; i <= e->nprocs; i++)
+    {
+        sim_free(&e->tasks[i].proc);
+    }
+    for (i = 0; i < e->nworkers; i++)
+    {
+        spsc_free(&e->workers[i].commands);
+        spsc_free(&e->workers[i].requests);
+    }
+    free(e->workers);
+    free(e->tasks);
+}
+
+
+// Thread side: carries out one command from the master
+static inline void engine_apply(struct engine *e, struct engine_command *cmd)
+{
+    struct engine_task *t = &e->tasks[cmd->simpid];
+
+    if (cmd->kind == ENGINE_LAUNCH)
+    {
+        sim_start(&t->proc, e->table, cmd->simpid, cmd->generation, cmd->pid);
+        t->state = ENGINE_RUNNABLE;
+    }
+    else if (cmd->kind == ENGINE_REPLY)
+    {
+        sim_reply(&t->proc, &cmd->msg);
+        t->state = ENGINE_RUNNABLE;
+    }
+    else
+    {
+        t->state = ENGINE_IDLE;
+    }
+}
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The master's event log. Every create, request, release, terminate and deadlock event is a fixed-size binary
+ * record appended to an in-memory ring; a writer thread drains the ring to the log file in large batches, so
+ * the master loop never waits on file I/O unless the writer falls a whole ring behind. Nothing is dropped.
+ * The file is a log_header followed by records, and logrender turns it back into the old text log.
+ */
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include "ring.h"
+
+#define EVENT_LOG_MAGIC "OSSEVLOG"
+#define EVENT_LOG_VERSION 2
+#define EVENT_LOG_EVENTS (1 << 16)  // ring capacity, a power of two
+#define EVENT_LOG_BATCH 4096        // the writer wakes early once this many events are waiting
+#define EVENT_LOG_FLUSH_MS 10       // and otherwise writes whatever is there this often
+
+// Event types. Each is one line of the text log, except the deadlock report: EV_DEADLOCK starts the line,
+// then every deadlocked process is an EV_WAITER followed by an EV_WAITS_FOR per process it waits for.
+// A request, release or unblock of a batch is one event per (resource, count) pair, all with the same result.
+enum {
+    EV_CREATE = 1,              // pid
+    EV_REQUEST,                 // pid, simpid, arg resource, count, value GRANTED/BLOCKED/DENIED
+    EV_RELEASE,                 // pid, simpid, arg resource, count
+    EV_TERMINATE,               // pid, simpid
+    EV_TOTALPROCS,              // arg processes left running
+    EV_UNBLOCK,                 // pid, simpid, arg resource granted, count
+    EV_STALE,                   // simpid, value generation of the dropped message
+    EV_DEADLOCK,                // arg processes deadlocked
+    EV_WAITER,                  // simpid
+    EV_WAITS_FOR,               // simpid waited for, arg 1 if it is the first for this waiter
+    EV_KILL,                    // pid, simpid of the victim
+    EV_DETECTION                // arg processes killed, value wall ns the pass took
+};
+
+struct log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct log_event {
+    uint64_t time;              // simulated time of the event
+    int64_t value;
+    int type;
+    int pid;
+    int simpid;
+    int arg;
+    int count;                  // instances, for requests, releases and unblocks
+    int reserved;               // keeps records a multiple of 8 bytes with no uninitialized padding
+};
+
+struct event_log {
+    unsigned int head;          // next record to fill, only advanced by the master
+    int sleeping;               // set while the writer waits for a batch to build up
+    char pad_head[CACHELINE - sizeof(unsigned int) - sizeof(int)];
+    unsigned int tail;          // next record to write out, only advanced by the writer
+    char pad_tail[CACHELINE - sizeof(unsigned int)];
+    struct log_event *events;
+    int fd;
+    int done;                   // set by event_log_close, the writer drains the ring and exits
+    int failed;                 // a write failed, the rest of the log is discarded
+    long stalls;                // times the master found the ring full and had to wait for the writer
+    long batches;               // writes the writer made
+    pthread_t writer;
+};
+
+
+// Writes all of buf, returns -1 if the file won't take it
+static inline int event_log_write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (bytes > 0)
+    {
+        if ((n = write(fd, p, bytes)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+
+static inline void *event_log_writer(void *arg)
+{
+    struct event_log *log = arg;
+    unsigned int tail = log->tail;
+    unsigned int head, chunk;
+
+    while (true)
+    {
+        head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+        if (head - tail < EVENT_LOG_BATCH && !__atomic_load_n(&log->done, __ATOMIC_ACQUIRE))
+        {
+            // the master only wakes us if it sees the flag after publishing a full batch
+            __atomic_store_n(&log->sleeping, 1, __ATOMIC_SEQ_CST);
+            head = __atomic_load_n(&log->head, __ATOMIC_SEQ_CST);
+            if (head - tail < EVENT_LOG_BATCH)
+            {
+                futex_wait_ms(&log->head, head, EVENT_LOG_FLUSH_MS);
+            }
+            __atomic_store_n(&log->sleeping, 0, __ATOMIC_SEQ_CST);
+            head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+        }
+        if (head == tail && __atomic_load_n(&log->done, __ATOMIC_ACQUIRE))
+        {
+            return NULL;
+        }
+        // the records go straight from the ring to the file, in at most two pieces if they wrap around
+        while (tail != head)
+        {
+            chunk = head - tail;
+            if (chunk > EVENT_LOG_EVENTS - (tail % EVENT_LOG_EVENTS))
+            {
+                chunk = EVENT_LOG_EVENTS - (tail % EVENT_LOG_EVENTS);
+            }
+            if (!log->failed && event_log_write_all(log->fd, &log->events[tail % EVENT_LOG_EVENTS],
+                                                    chunk * sizeof(struct log_event)) == -1)
+            {
+                log->failed = 1;
+            }
+            log->batches++;
+            tail += chunk;
+        }
+        __atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+        futex_wake(&log->tail, 1);
+    }
+}
+
+
+// Creates the log file and starts the writer. Returns 0, or -1 with errno set.
+static inline int event_log_open(struct event_log *log, const char *filename)
+{
+    struct log_header header;
+    sigset_t all, old;
+    int err;
+
+    memset(log, 0, sizeof(*log));
+    if ((log->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        return -1;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+    header.version = EVENT_LOG_VERSION;
+    header.record_size = sizeof(struct log_event);
+    if (event_log_write_all(log->fd, &header, sizeof(header)) == -1)
+    {
+        close(log->fd);
+        return -1;
+    }
+    if ((err = posix_memalign((void **)&log->events, CACHELINE, EVENT_LOG_EVENTS * sizeof(struct log_event))))
+    {
+        log->events = NULL;
+        close(log->fd);
+        errno = err;
+        return -1;
+    }
+    // the writer blocks every signal, so the timer and SIGINT always land on the master
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    err = pthread_create(&log->writer, NULL, event_log_writer, log);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+    {
+        free(log->events);
+        log->events = NULL;
+        close(log->fd);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+
+// Master side: appends one record, waiting for the writer only if the ring is full
+static inline void event_log_append(struct event_log *log, const struct log_event *ev)
+{
+    unsigned int head = log->head;
+    unsigned int tail;
+
+    while (head - (tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE)) == EVENT_LOG_EVENTS)
+    {
+        log->stalls++;
+        futex_wait(&log->tail, tail);
+    }
+    log->events[head % EVENT_LOG_EVENTS] = *ev;
+    __atomic_store_n(&log->head, head + 1, __ATOMIC_SEQ_CST);
+    if (head + 1 - tail >= EVENT_LOG_BATCH && __atomic_load_n(&log->sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&log->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        futex_wake(&log->head, 1);
+    }
+}
+
+
+// Flushes everything appended so far, stops the writer and closes the file. Safe to call on a log that was
+// never opened or is already closed. Returns -1 if any of the log could not be written.
+static inline int event_log_close(struct event_log *log)
+{
+    if (log->events == NULL)
+    {
+        return 0;
+    }
+    __atomic_store_n(&log->done, 1, __ATOMIC_RELEASE);
+    futex_wake(&log->head, 1);
+    pthread_join(log->writer, NULL);
+    free(log->events);
+    log->events = NULL;
+    close(log->fd);
+    return log->failed ? -1 : 0;
+}
+
+#endif
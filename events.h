@@ -0,0 +1,125 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The future events of OSS's discrete-event mode (-D), kept in a binary min-heap by simulated time. In that
+ * mode nothing spins on the clock: every launch, every slice of a process's work coming to an end and every
+ * detection pass is an event, and the clock jumps straight to the earliest one. There is at most one pending
+ * event per simpid plus a launch and a detection pass, so the heap stays a few levels deep and a push or a
+ * pop is a handful of compares. Events due at the same time come out in the order they were pushed, which
+ * keeps a run the same from one time to the next.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// What happens at an event
+#define EVENT_LAUNCH 1          // the next process is due to start
+#define EVENT_STEP 2            // simpid's process has finished its last slice of work or has its reply
+#define EVENT_DETECT 3          // a detection pass is due
+
+struct sim_event {
+    uint64_t time;              // simulated ns
+    uint64_t seq;               // the order it was pushed in, breaks ties in time
+    int kind;
+    int simpid;                 // for EVENT_STEP
+    unsigned int generation;    // the process it is for, so an event outliving its process is ignored
+};
+
+struct event_queue {
+    struct sim_event *heap;
+    int count;
+    int capacity;
+    uint64_t seq;               // events pushed so far
+};
+
+
+// Sets up an empty queue with room for capacity events to start with. Returns 0, or -1 if it can't be allocated.
+static inline int event_queue_init(struct event_queue *q, int capacity)
+{
+    q->count = 0;
+    q->seq = 0;
+    q->capacity = capacity > 0 ? capacity : 1;
+    q->heap = malloc(q->capacity * sizeof(struct sim_event));
+    return q->heap == NULL ? -1 : 0;
+}
+
+
+static inline void event_queue_free(struct event_queue *q)
+{
+    free(q->heap);
+    q->heap = NULL;
+}
+
+
+// Whether a is due before b
+static inline int event_before(const struct sim_event *a, const struct sim_event *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+
+// Schedules an event, growing the heap if it is full. Returns 0, or -1 if it can't grow.
+static inline int event_push(struct event_queue *q, uint64_t time, int kind, int simpid, unsigned int generation)
+{
+    struct sim_event ev = {time, q->seq++, kind, simpid, generation};
+    struct sim_event *grown;
+    int i, parent;
+
+    if (q->count == q->capacity)
+    {
+        if ((grown = realloc(q->heap, 2 * q->capacity * sizeof(struct sim_event))) == NULL)
+        {
+            return -1;
+        }
+        q->heap = grown;
+        q->capacity *= 2;
+    }
+    // sift up from the new leaf, moving parents down instead of swapping
+    for (i = q->count++; i > 0; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (!event_before(&ev, &q->heap[parent]))
+        {
+            break;
+        }
+        q->heap[i] = q->heap[parent];
+    }
+    q->heap[i] = ev;
+    return 0;
+}
+
+
+// Removes the earliest event into ev. Returns 0 if there is none.
+static inline int event_pop(struct event_queue *q, struct sim_event *ev)
+{
+    struct sim_event last;
+    int i, child;
+
+    if (q->count == 0)
+    {
+        return 0;
+    }
+    *ev = q->heap[0];
+    last = q->heap[--q->count];
+    // sift the last leaf down from the root, moving the earlier child up each time
+    for (i = 0; (child = 2 * i + 1) < q->count; i = child)
+    {
+        if (child + 1 < q->count && event_before(&q->heap[child + 1], &q->heap[child]))
+        {
+            child++;
+        }
+        if (!event_before(&q->heap[child], &last))
+        {
+            break;
+        }
+        q->heap[i] = q->heap[child];
+    }
+    q->heap[i] = last;
+    return 1;
+}
+
+#endif
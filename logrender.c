@@ -0,0 +1,137 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Renders the binary event log OSS writes with -l back into the text log, one line per event.
+ * Usage: ./logrender logfile [outfile], the text goes to stdout if no outfile is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clock.c"
+#include "eventlog.h"
+#include "resource.h"
+
+
+// Writes what a request, release or unblock moved: just the resource for a single instance, as the master
+// used to log it, or the count and the resource for more
+void render_units(FILE *out, struct log_event *ev)
+{
+    if (ev->count > 1)
+    {
+        fprintf(out, "%d instances of resource %d", ev->count, ev->arg);
+    }
+    else
+    {
+        fprintf(out, "resource %d", ev->arg);
+    }
+}
+
+
+// Prints one event the way the master used to log it
+void render_event(FILE *out, struct log_event *ev)
+{
+    switch (ev->type)
+    {
+        case EV_CREATE:
+            fprintf(out, "Master: Creating child process %d at my time %d.%d\n", ev->pid, splitClock(ev->time).sec,
+                    splitClock(ev->time).nsec);
+            break;
+        case EV_REQUEST:
+            fprintf(out, "Process %d with simpid %d is requesting ", ev->pid, ev->simpid);
+            render_units(out, ev);
+            fprintf(out, ": %s\n", ev->value == GRANTED ? "granted" : ev->value == BLOCKED ? "blocked" : "denied");
+            break;
+        case EV_RELEASE:
+            fprintf(out, "Process %d with simpid %d is releasing ", ev->pid, ev->simpid);
+            render_units(out, ev);
+            fprintf(out, "\n");
+            break;
+        case EV_TERMINATE:
+            fprintf(out, "Process %d with simpid %d is terminating.\n", ev->pid, ev->simpid);
+            break;
+        case EV_TOTALPROCS:
+            fprintf(out, "Totalprocs %d\n", ev->arg);
+            break;
+        case EV_UNBLOCK:
+            fprintf(out, "Master unblocking process %d with simpid %d and granting ", ev->pid, ev->simpid);
+            render_units(out, ev);
+            fprintf(out, "\n");
+            break;
+        case EV_STALE:
+            fprintf(out, "Master dropping a stale message from simpid %d generation %u\n", ev->simpid,
+                    (unsigned int)ev->value);
+            break;
+        case EV_DEADLOCK:
+            fprintf(out, "Master detected deadlock among %d processes at time %d.%d:", ev->arg,
+                    splitClock(ev->time).sec, splitClock(ev->time).nsec);
+            break;
+        case EV_WAITER:
+            fprintf(out, " %d->", ev->simpid);
+            break;
+        case EV_WAITS_FOR:
+            fprintf(out, "%s%d", ev->arg ? "" : ",", ev->simpid);
+            break;
+        case EV_KILL:
+            fprintf(out, "\nMaster killing process %d with simpid %d to resolve the deadlock\n", ev->pid, ev->simpid);
+            break;
+        case EV_DETECTION:
+            fprintf(out, "Master detection pass at time %d.%d killed %d processes in %lld ns\n",
+                    splitClock(ev->time).sec, splitClock(ev->time).nsec, ev->arg, (long long)ev->value);
+            break;
+        default:
+            fprintf(out, "Unknown event type %d\n", ev->type);
+            break;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct log_header header;
+    struct log_event events[EVENT_LOG_BATCH];
+    FILE *in, *out = stdout;
+    size_t n, i;
+    long total = 0;
+
+    if (argc < 2 || argc > 3)
+    {
+        printf("Usage: ./logrender logfile [outfile]\n");
+        return 1;
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL)
+    {
+        perror("logrender fopen");
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic))
+        || header.version != EVENT_LOG_VERSION || header.record_size != sizeof(struct log_event))
+    {
+        fprintf(stderr, "%s is not a version %d OSS event log\n", argv[1], EVENT_LOG_VERSION);
+        fclose(in);
+        return 1;
+    }
+    if (argc == 3 && (out = fopen(argv[2], "w")) == NULL)
+    {
+        perror("logrender fopen");
+        fclose(in);
+        return 1;
+    }
+
+    while ((n = fread(events, sizeof(struct log_event), EVENT_LOG_BATCH, in)) > 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            render_event(out, &events[i]);
+        }
+        total += n;
+    }
+    fclose(in);
+    if (out != stdout)
+    {
+        fclose(out);
+        printf("Rendered %ld events\n", total);
+    }
+    return 0;
+}
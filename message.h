@@ -0,0 +1,75 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The message format shared by OSS and User. Every request, release and termination is sent as one of these
+ * fixed-layout binary records, so neither side has to format or parse text on the hot path.
+ * A request or release carries up to MAXBATCH (resource, count) pairs, which the master grants or denies as a
+ * whole, so a process with a large claim can move it in one round trip instead of one per instance.
+ * It also holds the control block users use to wake the master when it is idle.
+ */
+
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define CACHELINE 64
+
+#define TERMINATE 1
+#define REQUEST 2
+#define RELEASE 3
+
+#define MAXBATCH 8              // the most (resource, count) pairs one message can carry
+
+struct batch_item {
+    int resource;               // resource class
+    int count;                  // instances requested or released; in a reply, how many changed hands
+};
+
+struct mesg_buf {
+    long mtype;                 // MASTER_MTYPE for requests, REPLY_MTYPE(simpid) for replies
+    int pid;                    // real pid of the user process
+    int simpid;                 // simulated pid (slot in the process table)
+    int opcode;                 // TERMINATE, REQUEST or RELEASE
+    unsigned int generation;    // which process holding simpid sent it, see slots.h
+    uint64_t timestamp;         // simulated time the message was sent, in nanoseconds
+    int nitems;                 // pairs in use in items, 0 for TERMINATE
+    struct batch_item items[MAXBATCH];  // distinct resources, only the first nitems are sent
+};
+
+// Shared between the master and every user so users can wake the master when it is idle.
+// The master raises sleeping before it blocks on the doorbell eventfd; whoever clears it rings the doorbell.
+struct master_ctl {
+    int sleeping;               // nonzero while the master is blocked waiting for work
+    int doorbell;               // eventfd inherited by every user
+    uint64_t nextfork;          // simulated time of the next scheduled fork, in nanoseconds
+};
+
+// Requests to the master all carry MASTER_MTYPE so the master never picks up its own replies,
+// replies carry REPLY_MTYPE of the simpid they are addressed to
+#define MASTER_MTYPE 1
+#define REPLY_MTYPE(simpid) ((long)(simpid) + 1)
+
+// The number of bytes after mtype, which is what msgsnd and msgrcv expect as the message size
+#define MSGSIZE (sizeof(struct mesg_buf) - sizeof(long))
+// The bytes msgsnd has to copy for a message with nitems pairs: the unused tail of items is left off
+#define MSG_BYTES(nitems) (offsetof(struct mesg_buf, items) + (size_t)(nitems) * sizeof(struct batch_item) - \
+                           sizeof(long))
+
+
+
+// Wakes the master if it is asleep. Only the first caller after the master goes to sleep pays for the write.
+static inline void doorbell_ring(struct master_ctl *ctl)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&ctl->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        write(ctl->doorbell, &one, sizeof(one));
+    }
+}
+
+#endif
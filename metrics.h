@@ -0,0 +1,137 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Log-linear latency histograms in the style of HdrHistogram. Values below HIST_SUB get a bucket each; above
+ * that every power of two is split into HIST_SUB buckets, so a recorded value is off by at most 1/HIST_SUB
+ * (12.5%) over the whole 64-bit range with a fixed HIST_BUCKETS counters. Recording is a count-leading-zeros,
+ * a shift and an increment, with no locks: each histogram belongs to the one thread that records into it.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+
+static inline void hist_init(struct histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+
+static inline int hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < HIST_SUB)
+    {
+        return (int)v;
+    }
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+
+// The largest value that lands in bucket i
+static inline uint64_t hist_bucket_max(int i)
+{
+    int shift;
+
+    if (i < 2 * HIST_SUB)
+    {
+        return i;
+    }
+    shift = i / HIST_SUB - 1;
+    return (((uint64_t)(HIST_SUB + i % HIST_SUB)) << shift) + ((1ULL << shift) - 1);
+}
+
+
+static inline void hist_record(struct histogram *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+    {
+        h->min = v;
+    }
+    if (v > h->max)
+    {
+        h->max = v;
+    }
+}
+
+
+// Returns the value at quantile q (0 to 1), to within a bucket, or 0 if nothing was recorded
+static inline uint64_t hist_quantile(const struct histogram *h, double q)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    rank = (uint64_t)(q * h->count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            return hist_bucket_max(i) < h->max ? hist_bucket_max(i) : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+// Writes a histogram as a JSON object: summary statistics, and the non-empty buckets if with_buckets is set
+// as [largest value, count] pairs
+static inline void hist_write_json(FILE *out, const struct histogram *h, int with_buckets)
+{
+    int i, first = 1;
+
+    fprintf(out, "{\"count\": %llu, \"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+            "\"p999\": %llu, \"max\": %llu", (unsigned long long)h->count,
+            (unsigned long long)(h->count ? h->min : 0), h->count ? (double)h->sum / h->count : 0.0,
+            (unsigned long long)hist_quantile(h, 0.5), (unsigned long long)hist_quantile(h, 0.9),
+            (unsigned long long)hist_quantile(h, 0.99), (unsigned long long)hist_quantile(h, 0.999),
+            (unsigned long long)h->max);
+    if (with_buckets)
+    {
+        fprintf(out, ", \"buckets\": [");
+        for (i = 0; i < HIST_BUCKETS; i++)
+        {
+            if (h->buckets[i])
+            {
+                fprintf(out, "%s[%llu, %u]", first ? "" : ", ", (unsigned long long)hist_bucket_max(i),
+                        h->buckets[i]);
+                first = 0;
+            }
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out, "}");
+}
+
+#endif
@@ -25,7 +25,6 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/ipc.h>
-#include <sys/shm.h>
 #include <sys/time.h>
 #include <errno.h>
 #include <signal.h>
@@ -34,58 +33,328 @@
 #include <sys/msg.h>
 #include <string.h>
 #include "clock.c"
+#include "message.h"
+#include "ring.h"
+#include "proctable.h"
+#include "resource.h"
+#include "slots.h"
+#include "pool.h"
+#include "eventlog.h"
+#include "trace.h"
+#include "metrics.h"
+#include "prng.h"
+#include "replay.h"
+#include "pipeline.h"
+#include "shard.h"
+#include "engine.h"
+#include "events.h"
+#include "region.h"
+#include "sweep.h"
+#include "snapshot.h"
 #include <stdbool.h>
-#include <semaphore.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sched.h>
 
 
-#define SHAREKEY 92195
 #define TIMER_MSG "Received timer interrupt!\n"
-#define MSGKEY 110992
-#define TABLEKEY 210995
 #define BILLION 1000000000
-#define PR_LIMIT 17
+#define DEFAULT_PROCS 18
+#define DEFAULT_RESOURCES 20
+#define DEFAULT_LAUNCH_MS 500
 #define MAXCLAIM 3
-#define SEM_NAME "/mutex-semaphore-jbwd4"
 #define MILLISEC 1000000
-#define LINELIMIT 100000
-#define TERMINATE 1
-#define REQUEST 2
-#define RELEASE 3
-
-// Declare some global variables so that shared memory can be cleaned from the interrupt handler
-int ClockID;
-struct clock *Clock;
-int MsgID;
-int ProcTableID;
-FILE *fp;
-sem_t *sem_for_mutex;
-
-struct mesg_buf {
-    long mtype;
-    char mtext[100];
-} message;
+#define IDLE_TIMEOUT_MS 10
+#define DEFAULT_METRICS "metrics.json"
+#define MAX_RECEIVERS 8
+#define STOP_RECEIVER 0         // the opcode the master sends its own queue receivers to stop them
+#define OPTIONS "hrwDs:n:i:l:t:T:x:d:v:g:m:S:o:p:z:b:P:k:e:G:J:C:c:R:"
+#define SWEEP_RESERVED "hGJlmopC" // options a sweep sets or refuses itself, kept out of the grid and of what its runs share
+#define DEFAULT_SNAPSHOT_MS 10000
+#define SNAPSHOT_EVERY 1023     // events between looks at the wall clock for whether a snapshot is due, less one
+
+// Declare some global variables so that the threads and the interrupt handler can reach them
+struct region Region;           // the memory shared with users, see region.h
+uint64_t *Clock;
+int MsgID = -1;
+struct ring_channel *Rings;
+struct pool_slot *Pool;         // NULL unless processes are launched from the pre-forked pool (-w)
+pid_t *workers;                 // pid of each simpid's pool worker
+struct master_ctl *Ctl;
+int transport = TRANSPORT_QUEUE;
+int nprocs = DEFAULT_PROCS;
+int *procarray;                 // pid of the process running as each simpid, 0 if free, -pid if killed but not reaped
+int unreaped = 0;               // simpids held back by killed processes that haven't been reaped yet
+struct slot_allocator slots;    // free simpids and their generations
+struct event_log eventlog;
+struct prng rng;                // the master's stream of the run's seed
+FILE *recording;                // the trace being recorded with -o, NULL if none
+bool replaying = false;         // replaying a trace with -p: there are no user processes to signal or reply to
+
+// A request as a receiver thread took it off the transport
+struct received_msg {
+    struct mesg_buf msg;
+    long long at;               // wall ns it was received
+};
+
+// Work for the spawner thread and what it reports back
+enum {
+    SPAWN_USER = 1,             // fork a user to run simpid's current process
+    SPAWN_WORKER,               // fork a pool worker for simpid in place of a killed one
+    CHILD_REAPED                // the spawner reaped pid
+};
+
+struct spawn_record {
+    int kind;
+    int simpid;
+    unsigned int generation;    // the generation to run, for SPAWN_USER
+    pid_t pid;                  // the child, on the way back
+};
+
+// The threads of the master's pipeline (-P) and the queues between them. The master loop is the only consumer
+// of received and results and the only producer of commands.
+struct pipeline {
+    int nreceivers;
+    int done;                                   // set when the run is over, every thread exits
+    struct spsc_queue received[MAX_RECEIVERS];  // receiver i -> master
+    pthread_t receivers[MAX_RECEIVERS];
+    struct spsc_queue commands;                 // master -> spawner
+    struct spsc_queue results;                  // spawner -> master
+    pthread_t spawner;
+    struct bell master_bell;                    // rung by the receivers and the spawner
+    struct bell spawner_bell;                   // rung by the master
+    int sigfd;                                  // SIGCHLD, read by the spawner
+    uint64_t *launched_sim;                     // when each simpid's pending launch was decided, for its log line
+    int next;                                   // the receiver queue to look at first
+};
+
+struct pipeline *Pipeline;      // NULL unless the master runs as a pipeline
+struct shard_set *Shards;       // NULL unless the resource manager is sharded (-k)
+struct engine *Engine;          // NULL unless the processes run on the master's own threads (-e)
+
+// The processes of the discrete-event mode (-D), which the master loop steps itself between events
+struct discrete {
+    struct event_queue events;
+    struct sim_process *procs;                  // indexed by simpid
+    struct proc_table *table;
+    int serial;                                 // processes have no pid, each gets the next serial number instead
+    long handled;                               // events taken off the queue
+    long steps;                                 // sim_step calls
+};
+
+struct discrete *Discrete;      // NULL unless the processes run as discrete events (-D)
+
+// What snapshots have cost. The children writing them fill in their part, so it lives in shared memory.
+struct snapshot_stats {
+    long taken;                 // writers forked
+    long skipped;               // snapshots due while the last was still being written
+    long written;               // snapshots the writers finished
+    long failed;
+    long long fork_ns;          // wall time the master spent forking writers, the only pause the run sees
+    long long fork_max_ns;
+    long long write_ns;         // wall time the writers spent writing
+    long long write_max_ns;
+    uint64_t bytes;             // the size of the last one
+};
+
+// Periodic snapshots of a discrete-event run (-C). Each is written by a child forked from the master, from its
+// copy-on-write view of the master's memory, so the run carries on while it is written.
+struct snapshots {
+    const char *path;           // NULL unless -C
+    long long interval_ns;      // wall ns between snapshots
+    long long next_at;          // wall ns the next is due
+    pid_t writer;               // the child writing one, 0 if none
+    struct proc_table *table;   // the writer's copy of the process table
+    struct snapshot_stats *stats;
+};
+
+struct snapshots Snapshots;
+
+struct detection_stats {
+    long passes;                // detection passes run
+    long deadlocks;             // passes that found a deadlock
+    long victims;               // processes killed to break deadlocks
+    long long total_ns;         // wall time spent in detection passes
+};
+
+struct launch_stats {
+    long launches;              // processes launched
+    long long launch_ns;        // wall time the master spent launching them
+    long first_requests;        // launched processes whose first request has arrived
+    long long first_request_ns; // total wall time from launch to first request
+    long long *launched_at;     // when each simpid's current process was launched, 0 once its first request arrived
+};
+
+// Latency histograms and counters, dumped as JSON at exit and on SIGUSR2. Only the master loop records
+// into them, so none of it needs a lock.
+struct metrics {
+    const char *path;                   // where the summary is written
+    uint64_t seed;
+    struct resource_manager *rm;        // grants and blocks are counted by the resource manager
+    struct detection_stats *detection;
+    struct launch_stats *launches;
+    long denials;
+    long terminations;
+    long stale;                         // messages dropped for a stale generation
+    long messages;                      // requests and releases handled
+    long units;                         // instances those moved: granted, released or handed to a waiter
+    long depth_samples;                 // the number of blocked processes is sampled every time one blocks
+    long long depth_total;
+    int depth_max;
+    long long *requested_at;            // when each simpid's blocked request arrived, wall ns
+    struct histogram wait_sim;          // request sent to granted, simulated ns
+    struct histogram wait_wall;         // request received to granted, wall ns
+    struct histogram *simpid_sim;       // the same two for each simpid
+    struct histogram *simpid_wall;
+    struct histogram *blocked;          // simulated ns blocked requests waited, for each resource class
+    struct histogram unblocked;         // simulated ns each blocked request waited, whatever it was for
+    int grant_policy;                   // the order blocked requests were woken in
+    long long started;                  // wall ns the run started at, 0 until then
+    double started_cpu;                 // CPU seconds the master had used by then
+};
+
+static const char *grant_names[] = {"fifo", "srcf", "aging", "fair"};
+
+struct mesg_buf message;
+struct metrics metrics;
+static volatile sig_atomic_t dump_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;  // set by SIGINT and SIGALRM, the run stops early
+
+// Returns the current wall time in nanoseconds
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+
+// Returns the CPU time the master has used, user and system, in seconds
+static double cpu_seconds()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+// Writes the metrics summary as JSON, through a temporary file so a reader never sees half of it
+static void dump_metrics(struct metrics *m)
+{
+    char tmp[PATH_MAX];
+    struct rusage usage;
+    FILE *out;
+    double wall, cpu;
+    int i;
+
+    if (m->rm == NULL)
+    {
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", m->path);
+    if ((out = fopen(tmp, "w")) == NULL)
+    {
+        perror("Master metrics fopen");
+        return;
+    }
+    fprintf(out, "{\n  \"version\": 1,\n  \"seed\": %llu,\n  \"simulated_ns\": %llu,\n  \"grant_order\": \"%s\",\n",
+            (unsigned long long)m->seed, (unsigned long long)readClock(Clock), grant_names[m->grant_policy]);
+    fprintf(out, "  \"counters\": {\"launches\": %ld, \"grants\": %ld, \"blocks\": %ld, \"denials\": %ld, "
+            "\"terminations\": %ld, \"deadlocks\": %ld, \"victims\": %ld, \"stale_messages\": %ld, "
+            "\"messages\": %ld, \"units_moved\": %ld},\n",
+            m->launches->launches, m->rm->grants, m->rm->block_events, m->denials, m->terminations,
+            m->detection->deadlocks, m->detection->victims, m->stale, m->messages, m->units);
+    // the rates and the CPU are for the run so far, not the setup before it, and the peak RSS is the whole
+    // master's
+    getrusage(RUSAGE_SELF, &usage);
+    wall = m->started ? (now_ns() - m->started) / 1e9 : 0.0;
+    cpu = m->started ? cpu_seconds() - m->started_cpu : 0.0;
+    fprintf(out, "  \"run\": {\"wall_ns\": %.0f, \"cpu_ns\": %.0f, \"peak_rss_kb\": %ld, \"requests_per_sec\": %.0f, "
+            "\"grants_per_sec\": %.0f},\n", wall * 1e9, cpu * 1e9, usage.ru_maxrss,
+            wall > 0 ? m->messages / wall : 0.0, wall > 0 ? m->rm->grants / wall : 0.0);
+    fprintf(out, "  \"blocked_depth\": {\"samples\": %ld, \"mean\": %.2f, \"max\": %d},\n", m->depth_samples,
+            m->depth_samples ? (double)m->depth_total / m->depth_samples : 0.0, m->depth_max);
+    fprintf(out, "  \"wait_sim_ns\": ");
+    hist_write_json(out, &m->wait_sim, 1);
+    fprintf(out, ",\n  \"wait_wall_ns\": ");
+    hist_write_json(out, &m->wait_wall, 1);
+    fprintf(out, ",\n  \"blocked_sim_ns\": ");
+    hist_write_json(out, &m->unblocked, 1);
+    fprintf(out, ",\n  \"blocked_sim_ns_by_resource\": [");
+    for (i = 0; i < m->rm->nresources; i++)
+    {
+        fprintf(out, "%s\n    {\"resource\": %d, \"blocked_sim_ns\": ", i ? "," : "", i);
+        hist_write_json(out, &m->blocked[i], 0);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ],\n  \"per_simpid\": [");
+    for (i = 1; i <= m->rm->nprocs; i++)
+    {
+        fprintf(out, "%s\n    {\"simpid\": %d, \"wait_sim_ns\": ", i > 1 ? "," : "", i);
+        hist_write_json(out, &m->simpid_sim[i], 0);
+        fprintf(out, ", \"wait_wall_ns\": ");
+        hist_write_json(out, &m->simpid_wall[i], 0);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (fclose(out) != 0 || rename(tmp, m->path) == -1)
+    {
+        perror("Master metrics write");
+    }
+}
+
+
+// Records how long a request of simpid's waited to be granted: sim simulated ns from when it was sent, and
+// wall ns from when it reached the master
+static void record_wait(struct metrics *m, int simpid, uint64_t sim, long long wall)
+{
+    hist_record(&m->wait_sim, sim);
+    hist_record(&m->wait_wall, wall);
+    hist_record(&m->simpid_sim[simpid], sim);
+    hist_record(&m->simpid_wall[simpid], wall);
+}
+
+
+// Records a request granted just now: msg is the request, requested the wall time it arrived at the master
+static void record_grant(struct metrics *m, struct mesg_buf *msg, long long requested)
+{
+    record_wait(m, msg->simpid, readClock(Clock) - msg->timestamp, now_ns() - requested);
+}
+
+
+// Catches SIGUSR2 and leaves the dump to the main loop
+static void request_dump(int signo)
+{
+    dump_requested = 1;
+}
+
 
 // A function that catches SIGINT and SIGALRM
-// It prints an alert to the screen then sends a signal to all the child processes to terminate,
-// frees all the shared memory and closes the file.
+// It prints an alert to the screen, sends a signal to all the child processes to terminate and leaves the
+// rest of the shutdown to the main loop, which sees stop_requested within IDLE_TIMEOUT_MS and exits the way a
+// run that reached its end does. The metrics, the log and the trace are only written and closed from there,
+// like the dump SIGUSR2 asks for: the signal can land while the master is in malloc or stdio, halfway through
+// a histogram, or holding the log's lock.
 static void interrupt(int signo, siginfo_t *info, void *context)
 {
     int errsave;
 
     errsave = errno;
     write(STDOUT_FILENO, TIMER_MSG, sizeof(TIMER_MSG) - 1);
-    errno = errsave;
+    stop_requested = 1;
+    // keep the spawner from forking users after the group is signalled
+    if (Pipeline != NULL)
+    {
+        __atomic_store_n(&Pipeline->done, 1, __ATOMIC_RELEASE);
+    }
     signal(SIGUSR1, SIG_IGN);
     kill(-1*getpid(), SIGUSR1);
-    shmdt(Clock);
-    shmctl(ClockID, IPC_RMID, NULL);
-    msgctl(MsgID, IPC_RMID, NULL);
-    sem_close(sem_for_mutex);
-    sem_unlink(SEM_NAME);
-    shmctl(ProcTableID, IPC_RMID, NULL);
-    fclose(fp);
-    exit(1);
+    errno = errsave;
 }
 
 // A function from the setperiodic code, it sets up the interrupt handler
@@ -99,6 +368,12 @@ static int setinterrupt()
     {
         return 1;
     }
+    act.sa_flags = 0;
+    act.sa_handler = request_dump;
+    if (sigaction(SIGUSR2, &act, NULL) == -1)
+    {
+        return 1;
+    }
     return 0;
 }
 
@@ -122,399 +397,3001 @@ static int setperiodic(double sec)
 }
 
 
-// A function that determines if some target time has passed.
-int hasTimePassed(struct clock *current, struct clock dest)
+// Appends one event to the log
+static void log_event(int type, uint64_t time, int pid, int simpid, int arg, int64_t value)
+{
+    struct log_event ev;
+
+    ev.time = time;
+    ev.value = value;
+    ev.type = type;
+    ev.pid = pid;
+    ev.simpid = simpid;
+    ev.arg = arg;
+    ev.count = 0;
+    ev.reserved = 0;
+    event_log_append(&eventlog, &ev);
+}
+
+
+// Appends one event of the given type for every (resource, count) pair of msg
+static void log_batch(int type, uint64_t time, struct mesg_buf *msg, int64_t value)
 {
-    printf("Sem_wait hastimepassed\n");
-    sem_wait(sem_for_mutex);
-    if (dest.sec < current->sec)  // if destination.sec is greater than current.sec, it's definitely later
+    struct log_event ev;
+    int j;
+
+    ev.time = time;
+    ev.value = value;
+    ev.type = type;
+    ev.pid = msg->pid;
+    ev.simpid = msg->simpid;
+    ev.reserved = 0;
+    for (j = 0; j < msg->nitems; j++)
     {
-        return 1;
+        ev.arg = msg->items[j].resource;
+        ev.count = msg->items[j].count;
+        event_log_append(&eventlog, &ev);
     }
-    else if (dest.sec == current->sec) // otherwise if the seconds are equal, check the nanoseconds
+}
+
+
+// A function to get a random time between 0 and launchms milliseconds after now
+uint64_t getNextProcTime(uint64_t now, int launchms)
+{
+    uint64_t nsecs;
+    // get a random number between 1 and launchms milliseconds
+    nsecs = prng_below(&rng, (uint64_t)launchms * MILLISEC) + 1;
+    return now + nsecs;
+}
+
+
+// Takes the next request off the rings, scanning them round-robin so no simpid can starve the others.
+// Returns 0 if none is waiting. Only one thread may call it.
+int receive_ring(struct mesg_buf *msg)
+{
+    static int next = 1;
+    int i;
+
+    for (i = 0; i < nprocs; i++)
     {
-        if (dest.nsec <= current->nsec) // if destination ns is greater, it's later
+        int simpid = next;
+        next = (next % nprocs) + 1;
+        if (ring_pop(&Rings[simpid].requests, msg))
         {
             return 1;
         }
     }
-    sem_post(sem_for_mutex);
-    printf("Sem_post hastimepassed");
-    return 0;  // otherwise, time has not passed, return false
+    return 0;
 }
 
 
-// A function to get a random time between 0 and 500 milliseconds from now
-struct clock getNextProcTime(struct clock *c)
+// Takes the next message from the engine threads, looking at their queues round-robin
+int engine_receive(struct engine *e, struct mesg_buf *msg, long long *received)
 {
-    printf("sem_wait getnextproctime\n");
-    sem_wait(sem_for_mutex);
-    uint nsecs;
-    // get a random number between 1 and 500 milliseconds
-    nsecs = (rand() % (500 * MILLISEC)) + 1;
+    struct engine_request req;
+    int i;
+
+    for (i = 0; i < e->nworkers; i++)
+    {
+        int w = e->next;
+        e->next = (e->next + 1) % e->nworkers;
+        if (spsc_pop(&e->workers[w].requests, &req))
+        {
+            *msg = req.msg;
+            *received = req.at;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 
-    // make a new clock object initialized to the current time
-    struct clock newClock;
-    newClock.nsec = c->nsec;
-    newClock.sec = c->sec;
-    sem_post(sem_for_mutex);
-    printf("sem_post getnextproctime\n");
+// Sends an engine thread a command for simpid, generation and pid for a launch, msg for a reply, and wakes it
+void engine_command(struct engine *e, int kind, int simpid, unsigned int generation, int pid, struct mesg_buf *msg)
+{
+    struct engine_worker *w = &e->workers[ENGINE_WORKER(e, simpid)];
+    struct engine_command cmd;
 
-    // if adding the randomly generated amount of time causes us to move to the next second, increment sec
-    if ((newClock.nsec + nsecs) >= BILLION)
+    cmd.kind = kind;
+    cmd.simpid = simpid;
+    cmd.generation = generation;
+    cmd.pid = pid;
+    if (msg != NULL)
     {
-        newClock.sec = newClock.sec + 1;
-        newClock.nsec = nsecs - BILLION;
+        cmd.msg = *msg;
     }
-    else // otherwise, just add to nsec
+    while (!spsc_push(&w->commands, &cmd))
     {
-        newClock.nsec = newClock.nsec + nsecs;
+        sched_yield();
     }
-    return newClock; // return the new clock object
+    bell_ring(&w->bell);
 }
 
 
-int getSimpid(int procarray[19])
+// Schedules an event in the discrete-event mode, which can only fail for want of memory
+void discrete_schedule(struct discrete *d, uint64_t time, int kind, int simpid, unsigned int generation)
 {
-    int i;
-    for (i = 1; i < 19; i++)
+    if (event_push(&d->events, time, kind, simpid, generation) == -1)
     {
-        if (procarray[i] == 0)
-        {
-            return i;
-        }
+        perror("Master event_push");
+        exit(1);
     }
-    return -1;
 }
 
 
-int main(int argc, char * argv[]) {
-    int i, j, pid, c, status, resource, info;
-    int linecount = 0;
-    int maxprocs = 5;
-    int endtime = 20;
-    int pr_count = 0;
-    int totalprocs = 0;
-    char* filename;
-    pid_t wait = 0;
-    bool timeElapsed = false;
-    char messageString[100];
-    char* temp;
-    int procarray[19];
-    int msgerror;
-    int allocation_table[19][20];
-    int (*proc_max_resources)[20];
-    int resource_table[20];
-    int current_resources[20];
-    struct clock endclocktime;
-    struct clock nextTime;
-    int simpid;
-    char strsimpid[5];
+// Hands a process its reply, and lets it carry on at the current time unless that was the end of it
+void discrete_reply(struct discrete *d, struct mesg_buf *msg)
+{
+    struct sim_process *p = &d->procs[msg->simpid];
 
-    // Process command line arguments
-    if(argc == 1) //if no arguments passed
+    sim_reply(p, msg);
+    if (p->phase != SIM_EXITED)
     {
-        printf("ERROR: command line options required, please run ./oss -h for usage instructions.\n");
-        return 1;
+        discrete_schedule(d, readClock(Clock), EVENT_STEP, msg->simpid, msg->generation);
     }
+}
+
+
+// Takes the next request from the receiver threads, looking at their queues round-robin
+int pipeline_receive(struct pipeline *p, struct mesg_buf *msg, long long *received)
+{
+    struct received_msg rec;
+    int i;
 
-    while ((c = getopt(argc, argv, "hs:l:t:")) != -1)
+    for (i = 0; i < p->nreceivers; i++)
     {
-        switch(c)
+        int r = p->next;
+        p->next = (p->next + 1) % p->nreceivers;
+        if (spsc_pop(&p->received[r], &rec))
         {
-            case 'h': // -h for help
-                printf("Usage: ./oss [-s x] [-t z] -l filename\n");
-                printf("-s x: x is the maximum number of concurrent processes (default 5)\n");
-                printf("-t z: z is the number of real time seconds you would like the program to run\n");
-                printf("-l filename: filename is the name you would like the log file to have. This is a required argument\n");
-                return 0;
-            case 's': // -s for max number of processes
-                if(isdigit(*optarg))
-                {
-                    maxprocs = atoi(optarg);
-                    if(maxprocs > PR_LIMIT)
-                    {
-                        printf("Error: Too many processes. No more than 17 allowed.\n");
-                        return(1);
-                    }
-                    printf("Max %d processes\n", maxprocs);
-                }
-                else
-                {
-                    printf("Error, -s must be followed by an integer!\n");
-                    return 1;
-                }
-                break;
-            case 'l': // -l for filename (required!)
-                filename = optarg;
-                printf("Log file name is: %s\n", filename);
-                break;
-            case 't': // -t for total running time (wall clock time)
-                if(isdigit(*optarg))
-                {
-                    endtime = atoi(optarg);
-                    printf("Max time to run: %d\n", endtime);
-                }
-                else
-                {
-                    printf("Error, -t must be followed by an integer!\n");
-                    return 1;
-                }
-                if(endtime <= 0)
-                {
-                    printf("Error: Number of processes must be positive, please run ./oss -h for more information\n");
-                    return 1;
-                }
-                break;
-            default: // anything else, fail
-                printf("Expected format: [-s x] -l filename -t z\n");
-                printf("-s for max number of processes, -l for log file name, and -t for number of seconds to run.\n");
-                return 1;
+            *msg = rec.msg;
+            *received = rec.at;
+            return 1;
         }
     }
+    return 0;
+}
 
-    if(!filename) //ensure filename was passed
+
+// Fetches the next request from whichever transport is in use, or from the receiver threads, along with the
+// wall time it was received. Returns 0 if no request is waiting.
+int receive_message(struct mesg_buf *msg, long long *received)
+{
+    int found;
+
+    if (Pipeline != NULL)
     {
-        printf("Error! Must specify a filename with the -l flag, please run ./oss -h for more info.\n");
-        return(1);
+        return pipeline_receive(Pipeline, msg, received);
     }
+    if (Engine != NULL)
+    {
+        return engine_receive(Engine, msg, received);
+    }
+    if (transport == TRANSPORT_RING)
+    {
+        found = receive_ring(msg);
+    }
+    else
+    {
+        found = msgrcv(MsgID, msg, MSGSIZE, MASTER_MTYPE, IPC_NOWAIT) != -1;
+    }
+    if (found)
+    {
+        *received = now_ns();
+    }
+    return found;
+}
 
 
-    // Set the timer-kill
-    if (setinterrupt() == -1)
+// Sends a reply back to the user process that sent msg
+void send_reply(struct mesg_buf *msg)
+{
+    if (replaying)
     {
-        perror("Failed to set up handler");
-        return 1;
+        return;
     }
-    if (setperiodic((long) endtime) == -1)
+    msg->mtype = REPLY_MTYPE(msg->simpid);
+    if (Engine != NULL)
     {
-        perror("Failed to set up timer");
-        return 1;
+        engine_command(Engine, ENGINE_REPLY, msg->simpid, 0, 0, msg);
+        return;
+    }
+    if (Discrete != NULL)
+    {
+        discrete_reply(Discrete, msg);
+        return;
+    }
+    if (transport == TRANSPORT_RING)
+    {
+        ring_reply(&Rings[msg->simpid], msg);
+        return;
     }
+    msgsnd(MsgID, msg, MSG_BYTES(msg->nitems), 0);
+}
 
-    endclocktime.nsec = 0;
-    endclocktime.sec = 2;
 
-    // Allocate & attach shared memory for the clock
-    ClockID = shmget(SHAREKEY, sizeof(int), 0777 | IPC_CREAT);
-    if(ClockID == -1)
+// Forks and execs a user for simpid. In pool mode it starts as the simpid's pool worker and parks until its
+// first launch, otherwise it runs one process as the given generation of simpid. Returns its pid.
+pid_t spawn_user(int simpid, unsigned int generation)
+{
+    char strsimpid[12];
+    char strregion[12];
+    char strgeneration[12];
+    char strseq[12];
+    sigset_t sigmask;
+    pid_t pid;
+
+    sprintf(strsimpid, "%i", simpid);
+    sprintf(strregion, "%d", Region.fd);
+    sprintf(strgeneration, "%u", generation);
+    char * argarray[] = {"./user", strsimpid, strregion, strgeneration, NULL, NULL};
+    if (Pool != NULL)
     {
-        perror("Master shmget");
+        sprintf(strseq, "%u", __atomic_load_n(&Pool[simpid].seq, __ATOMIC_ACQUIRE));
+        argarray[3] = POOL_ARG;
+        argarray[4] = strseq;
+    }
+    if ((pid = fork()) < 0)
+    {
+        perror("Fork failed!");
         exit(1);
     }
+    if(pid == 0)
+    {
+        // the master takes SIGCHLD through its signalfd, and the spawner thread blocks everything, the user
+        // starts with nothing blocked
+        sigemptyset(&sigmask);
+        sigprocmask(SIG_SETMASK, &sigmask, NULL);
+        if(execvp(argarray[0], argarray) < 0)
+        {
+            printf("Execution failed!\n");
+            exit(1);
+        }
+    }
+    return pid;
+}
+
 
-    Clock = (struct clock *)(shmat(ClockID, 0, 0));
-    if(Clock == -1)
+// Queues work for the spawner thread and wakes it
+void pipeline_command(struct pipeline *p, int kind, int simpid, unsigned int generation)
+{
+    struct spawn_record rec = {kind, simpid, generation, 0};
+
+    while (!spsc_push(&p->commands, &rec))
     {
-        perror("Master shmat");
-        exit(1);
+        sched_yield();
     }
+    bell_ring(&p->spawner_bell);
+}
+
+
+// Handles the exit of child pid. A killed deadlock victim's simpid can be handed out again now that it is
+// gone. In pool mode the victim was the simpid's worker, so a new one is started in its place first; the
+// spawner thread, if there is one, starts it and the simpid is freed once it reports back.
+void child_exited(pid_t pid)
+{
+    int i;
 
-    ProcTableID = shmget(TABLEKEY, sizeof(int[19][20]), 0777 | IPC_CREAT);
-    if(ProcTableID == -1)
+    for (i = 1; unreaped > 0 && i <= nprocs; i++)
     {
-        perror("Master shmget ProcTable");
-        exit(1);
+        if (procarray[i] == -pid)
+        {
+            procarray[i] = 0;
+            if (Pool != NULL && Pipeline != NULL)
+            {
+                pipeline_command(Pipeline, SPAWN_WORKER, i, 0);
+                return;
+            }
+            if (Pool != NULL)
+            {
+                workers[i] = spawn_user(i, slots.generation[i]);
+            }
+            slot_free(&slots, i);
+            unreaped--;
+            return;
+        }
     }
+}
 
-    proc_max_resources = shmat(ProcTableID, 0, 0);
 
-    if ((sem_for_mutex = sem_open(SEM_NAME, O_CREAT, 0660, 1)) == SEM_FAILED)
+// Reaps every child that has exited since the last call. sigfd is a non-blocking signalfd for SIGCHLD,
+// so this costs one read when nothing has exited. With sigfd -1 it does nothing: someone else reaps.
+void reap_children(int sigfd)
+{
+    struct signalfd_siginfo info;
+    pid_t pid;
+
+    if (sigfd == -1 || read(sigfd, &info, sizeof(info)) != sizeof(info))
     {
-        perror("Sem_open");
-        exit(1);
+        return;
+    }
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    {
+        child_exited(pid);
     }
+}
 
 
-    for (i = 0; i < 20; i++)
+// The pipeline's version of wait_for_work: the master sleeps on its own bell, which the receivers ring for
+// every request and the spawner for every report. With the message queue the users' doorbell is still the
+// master's to watch, for the clock passing the next fork time; with rings the receiver watches it and
+// passes that on.
+int pipeline_wait(struct pipeline *p, struct mesg_buf *msg, long long *received)
+{
+    struct pollfd fds[2];
+    uint64_t count;
+    int nfds = 1;
+    int found;
+
+    bell_arm(&p->master_bell);
+    if (transport == TRANSPORT_QUEUE)
     {
-        resource_table[i] = (rand() % 10) + 1;
+        __atomic_store_n(&Ctl->sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+    // a request or a report may have come in between the last check and raising the flags
+    found = pipeline_receive(p, msg, received);
+    if (found || !spsc_empty(&p->results))
+    {
+        __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&p->master_bell.sleeping, 0, __ATOMIC_SEQ_CST);
+        return found;
     }
 
-    for (i = 0; i < 20; i++)
+    fds[0].fd = p->master_bell.fd;
+    fds[0].events = POLLIN;
+    if (transport == TRANSPORT_QUEUE)
+    {
+        fds[1].fd = Ctl->doorbell;
+        fds[1].events = POLLIN;
+        nfds = 2;
+    }
+    poll(fds, nfds, IDLE_TIMEOUT_MS);
+    bell_clear(&p->master_bell);
+    if (transport == TRANSPORT_QUEUE)
     {
-        current_resources[i] = resource_table[i];
-        for (j = 0; j < 19; j++)
+        __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+        if (fds[1].revents & POLLIN)
         {
-            allocation_table[j][i] = 0;
-            proc_max_resources[j][i] = 0;
+            read(Ctl->doorbell, &count, sizeof(count));
         }
     }
+    return 0;
+}
+
+
+// Blocks until there is something for the master to do: a user rings the doorbell after sending a request
+// or when the clock passes the next fork time, a child exits, or IDLE_TIMEOUT_MS passes as a safety net.
+// Returns 1 if a request was received into msg.
+int wait_for_work(struct mesg_buf *msg, long long *received, int sigfd)
+{
+    struct pollfd fds[2];
+    uint64_t count;
 
-    for(i = 0; i < 19; i++)
+    if (Pipeline != NULL)
+    {
+        return pipeline_wait(Pipeline, msg, received);
+    }
+    __atomic_store_n(&Ctl->sleeping, 1, __ATOMIC_SEQ_CST);
+    // a request may have arrived between the last check and raising the flag
+    if (receive_message(msg, received))
     {
-        procarray[i] = 0;
+        __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+        return 1;
     }
 
-    // initialize the clock
-    Clock->sec = 0;
-    Clock->nsec = 0;
+    fds[0].fd = Ctl->doorbell;
+    fds[0].events = POLLIN;
+    fds[1].fd = sigfd;
+    fds[1].events = POLLIN;
+    poll(fds, 2, IDLE_TIMEOUT_MS);
+    __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+
+    if (fds[0].revents & POLLIN)
+    {
+        read(Ctl->doorbell, &count, sizeof(count));
+    }
+    if (fds[1].revents & POLLIN)
+    {
+        reap_children(sigfd);
+    }
+    return receive_message(msg, received);
+}
 
-    // Create the message queue
-    MsgID = msgget(MSGKEY, 0666 | IPC_CREAT);
 
-    // open file
-    fp = fopen(filename, "w");
+// Starts a process as simpid, by waking the simpid's pool worker or forking a new user, returns its pid.
+// In the pipeline the spawner thread does the forking, and this returns 0: the pid comes back later.
+// An engine task or a discrete-event process gets a serial number for a pid, and the latter's first step is
+// due at once.
+pid_t launch_process(int simpid)
+{
+    if (Engine != NULL)
+    {
+        engine_command(Engine, ENGINE_LAUNCH, simpid, slots.generation[simpid], ++Engine->serial, NULL);
+        return Engine->serial;
+    }
+    if (Discrete != NULL)
+    {
+        sim_start(&Discrete->procs[simpid], Discrete->table, simpid, slots.generation[simpid], ++Discrete->serial);
+        discrete_schedule(Discrete, readClock(Clock), EVENT_STEP, simpid, slots.generation[simpid]);
+        return Discrete->serial;
+    }
+    if (transport == TRANSPORT_RING)
+    {
+        ring_reset(&Rings[simpid]);
+    }
+    if (Pool != NULL)
+    {
+        pool_launch(&Pool[simpid], slots.generation[simpid]);
+        return workers[simpid];
+    }
+    if (Pipeline != NULL)
+    {
+        pipeline_command(Pipeline, SPAWN_USER, simpid, slots.generation[simpid]);
+        return 0;
+    }
+    return spawn_user(simpid, slots.generation[simpid]);
+}
 
 
-    // loop while we haven't used more than 100 processes or gone over 2 simulated seconds
-    while(!hasTimePassed(Clock, endclocktime))
+// Hands a request to the master through a receiver's queue. The master takes at most one request per user
+// at a time out of the transport, so the queue can only be full for as long as the master is busy.
+static void pipeline_deliver(struct pipeline *p, struct spsc_queue *q, struct received_msg *rec)
+{
+    rec->at = now_ns();
+    while (!spsc_push(q, rec))
     {
-        if (linecount > LINELIMIT)
-        {
-            printf("Line limit reached\n");
-        }
-//        sem_wait(sem_for_mutex);
-//        printf("Current time is: %d:%d\n", Clock->sec, Clock->nsec);
-//        sem_post(sem_for_mutex);
-//        printf("Next process at: %d:%d\n", nextTime.sec, nextTime.nsec);
-        if (totalprocs == 0)
-        {
-            printf("Totalprocs is 0\n");
-            simpid = 1;
-            procarray[1] = 1;
-            for (i = 0; i < 20; i++)
-            {
-                proc_max_resources[1][i] = rand() % MAXCLAIM;
-            }
+        sched_yield();
+    }
+    bell_ring(&p->master_bell);
+}
 
-            char * argarray[] = {"./user", "1", NULL};
-            if ((pid = fork()) < 0)
-            {
-                perror("Fork failed!");
+
+// A receiver thread for the message queue: blocks in msgrcv and passes every request on, until the master
+// sends it STOP_RECEIVER. Several of them can share the queue, the kernel hands each message to one.
+static void *receive_queue_thread(void *arg)
+{
+    struct spsc_queue *q = arg;
+    struct received_msg rec;
+
+    while (true)
+    {
+        if (msgrcv(MsgID, &rec.msg, MSGSIZE, MASTER_MTYPE, 0) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return NULL;
+        }
+        if (rec.msg.opcode == STOP_RECEIVER)
+        {
+            return NULL;
+        }
+        pipeline_deliver(Pipeline, q, &rec);
+    }
+}
+
+
+// The receiver thread for the rings. It takes over the users' doorbell from the master, and since the
+// doorbell also rings when the clock passes the next fork time, it rings the master's bell whenever it wakes.
+static void *receive_ring_thread(void *arg)
+{
+    struct spsc_queue *q = arg;
+    struct received_msg rec;
+    struct pollfd fd;
+    uint64_t count;
+
+    fd.fd = Ctl->doorbell;
+    fd.events = POLLIN;
+    while (!__atomic_load_n(&Pipeline->done, __ATOMIC_ACQUIRE))
+    {
+        if (receive_ring(&rec.msg))
+        {
+            pipeline_deliver(Pipeline, q, &rec);
+            continue;
+        }
+        __atomic_store_n(&Ctl->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (receive_ring(&rec.msg))
+        {
+            __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+            pipeline_deliver(Pipeline, q, &rec);
+            continue;
+        }
+        poll(&fd, 1, IDLE_TIMEOUT_MS);
+        __atomic_store_n(&Ctl->sleeping, 0, __ATOMIC_SEQ_CST);
+        if (fd.revents & POLLIN)
+        {
+            read(Ctl->doorbell, &count, sizeof(count));
+        }
+        bell_ring(&Pipeline->master_bell);
+    }
+    return NULL;
+}
+
+
+// Spawner side: reports a child started or reaped back to the master
+static void pipeline_report(struct pipeline *p, struct spawn_record *rec)
+{
+    while (!spsc_push(&p->results, rec))
+    {
+        sched_yield();
+    }
+    bell_ring(&p->master_bell);
+}
+
+
+// The spawner thread: forks what the master asks for and reaps every child that exits, so the master never
+// waits on either
+static void *spawner_thread(void *arg)
+{
+    struct pipeline *p = arg;
+    struct spawn_record rec;
+    struct signalfd_siginfo info;
+    struct pollfd fds[2];
+    pid_t pid;
+    bool busy;
+
+    fds[0].fd = p->spawner_bell.fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = p->sigfd;
+    fds[1].events = POLLIN;
+    while (!__atomic_load_n(&p->done, __ATOMIC_ACQUIRE))
+    {
+        busy = false;
+        while (spsc_pop(&p->commands, &rec))
+        {
+            rec.pid = spawn_user(rec.simpid, rec.generation);
+            pipeline_report(p, &rec);
+            busy = true;
+        }
+        if (read(p->sigfd, &info, sizeof(info)) == sizeof(info))
+        {
+            while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+            {
+                rec.kind = CHILD_REAPED;
+                rec.simpid = 0;
+                rec.pid = pid;
+                pipeline_report(p, &rec);
+            }
+            busy = true;
+        }
+        if (busy)
+        {
+            continue;
+        }
+        bell_arm(&p->spawner_bell);
+        if (spsc_empty(&p->commands))
+        {
+            poll(fds, 2, IDLE_TIMEOUT_MS);
+        }
+        bell_clear(&p->spawner_bell);
+    }
+    return NULL;
+}
+
+
+// Acts on everything the spawner has reported: a user it forked gets its pid filled in and its creation
+// logged, a new pool worker hands its simpid back, and a reaped child may free a victim's simpid
+void pipeline_collect(struct pipeline *p)
+{
+    struct spawn_record rec;
+    struct mesg_buf launch;
+
+    while (spsc_pop(&p->results, &rec))
+    {
+        if (rec.kind == SPAWN_USER)
+        {
+            procarray[rec.simpid] = rec.pid;
+            log_event(EV_CREATE, p->launched_sim[rec.simpid], rec.pid, rec.simpid, 0, 0);
+            if (recording != NULL)
+            {
+                memset(&launch, 0, sizeof(launch));
+                launch.pid = rec.pid;
+                launch.generation = rec.generation;
+                replay_write(recording, REPLAY_SPAWNED, rec.simpid, p->launched_sim[rec.simpid],
+                             readClock(Clock), &launch, NULL, 0);
+            }
+        }
+        else if (rec.kind == SPAWN_WORKER)
+        {
+            workers[rec.simpid] = rec.pid;
+            slot_free(&slots, rec.simpid);
+            unreaped--;
+        }
+        else
+        {
+            child_exited(rec.pid);
+        }
+    }
+}
+
+
+// Waits for the spawner to report the pid of simpid's new process, which has already sent a request: it
+// may get there before the fork has returned in the spawner. An interrupt stops the spawner, so it gives up then.
+void pipeline_await_spawn(struct pipeline *p, int simpid)
+{
+    while (procarray[simpid] == 0 && !stop_requested)
+    {
+        pipeline_collect(p);
+        if (procarray[simpid] == 0)
+        {
+            sched_yield();
+        }
+    }
+}
+
+
+// Starts nreceivers receiver threads and the spawner, which takes over SIGCHLD through sigfd.
+// Every thread blocks every signal, so the timer and SIGINT still land on the master.
+struct pipeline *pipeline_start(int nreceivers, int sigfd)
+{
+    struct pipeline *p = calloc(1, sizeof(struct pipeline));
+    sigset_t all, old;
+    int i, err = 0;
+
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    p->nreceivers = transport == TRANSPORT_RING ? 1 : nreceivers;
+    p->sigfd = sigfd;
+    p->launched_sim = calloc(nprocs + 1, sizeof(uint64_t));
+    p->master_bell.fd = eventfd(0, EFD_NONBLOCK);
+    p->spawner_bell.fd = eventfd(0, EFD_NONBLOCK);
+    if (p->launched_sim == NULL || p->master_bell.fd == -1 || p->spawner_bell.fd == -1 ||
+        spsc_init(&p->commands, 2 * (nprocs + 1), sizeof(struct spawn_record)) == -1 ||
+        spsc_init(&p->results, 4 * (nprocs + 1), sizeof(struct spawn_record)) == -1)
+    {
+        return NULL;
+    }
+    for (i = 0; i < p->nreceivers; i++)
+    {
+        if (spsc_init(&p->received[i], 2 * (nprocs + 1), sizeof(struct received_msg)) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    Pipeline = p;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < p->nreceivers && !err; i++)
+    {
+        err = pthread_create(&p->receivers[i], NULL,
+                             transport == TRANSPORT_RING ? receive_ring_thread : receive_queue_thread,
+                             &p->received[i]);
+    }
+    if (!err)
+    {
+        err = pthread_create(&p->spawner, NULL, spawner_thread, p);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+    {
+        perror("Master pthread_create");
+        exit(1);
+    }
+    return p;
+}
+
+
+// Stops every thread of the pipeline and frees it, closing the SIGCHLD signalfd the spawner took over.
+// Requests still in its queues are dropped, as they are left in the transport when the master runs alone.
+void pipeline_stop(struct pipeline *p)
+{
+    struct mesg_buf stop;
+    uint64_t one = 1;
+    int i;
+
+    __atomic_store_n(&p->done, 1, __ATOMIC_RELEASE);
+    if (transport == TRANSPORT_RING)
+    {
+        write(Ctl->doorbell, &one, sizeof(one));
+    }
+    else
+    {
+        memset(&stop, 0, sizeof(stop));
+        stop.mtype = MASTER_MTYPE;
+        stop.opcode = STOP_RECEIVER;
+        for (i = 0; i < p->nreceivers; i++)
+        {
+            msgsnd(MsgID, &stop, MSG_BYTES(0), 0);
+        }
+    }
+    write(p->spawner_bell.fd, &one, sizeof(one));
+    for (i = 0; i < p->nreceivers; i++)
+    {
+        pthread_join(p->receivers[i], NULL);
+        spsc_free(&p->received[i]);
+    }
+    pthread_join(p->spawner, NULL);
+    spsc_free(&p->commands);
+    spsc_free(&p->results);
+    close(p->master_bell.fd);
+    close(p->spawner_bell.fd);
+    close(p->sigfd);
+    free(p->launched_sim);
+    free(p);
+    Pipeline = NULL;
+}
+
+
+// An engine thread: carries out the master's commands and steps each of its running processes in turn, doing
+// what a user does with the clock and the master, until the run is over
+static void *engine_thread(void *arg)
+{
+    struct engine_worker *w = arg;
+    struct engine *e = Engine;
+    struct engine_command cmd;
+    struct engine_request req;
+    struct engine_task *t;
+    struct pollfd fd;
+    uint64_t now;
+    int simpid;
+    bool busy;
+
+    fd.fd = w->bell.fd;
+    fd.events = POLLIN;
+    while (!__atomic_load_n(&e->done, __ATOMIC_ACQUIRE))
+    {
+        busy = false;
+        while (spsc_pop(&w->commands, &cmd))
+        {
+            engine_apply(e, &cmd);
+        }
+        for (simpid = w->first; simpid <= e->nprocs; simpid += e->nworkers)
+        {
+            t = &e->tasks[simpid];
+            if (t->state != ENGINE_RUNNABLE)
+            {
+                continue;
+            }
+            busy = true;
+            w->steps++;
+            switch (sim_step(&t->proc, &req.msg))
+            {
+                case SIM_WORK:
+                    // as in do_work: moving the clock past the next fork time gives the master work
+                    now = advanceClock(e->clock, WORKCONSTANT);
+                    if (now >= __atomic_load_n(&e->ctl->nextfork, __ATOMIC_RELAXED))
+                    {
+                        doorbell_ring(e->ctl);
+                    }
+                    break;
+                case SIM_SEND:
+                    req.at = now_ns();
+                    while (!spsc_push(&w->requests, &req))
+                    {
+                        sched_yield();
+                    }
+                    t->state = ENGINE_WAITING;
+                    doorbell_ring(e->ctl);
+                    break;
+                default:
+                    t->state = ENGINE_IDLE;
+            }
+        }
+        if (busy)
+        {
+            continue;
+        }
+        bell_arm(&w->bell);
+        if (spsc_empty(&w->commands))
+        {
+            poll(&fd, 1, IDLE_TIMEOUT_MS);
+        }
+        bell_clear(&w->bell);
+    }
+    return NULL;
+}
+
+
+// Starts nworkers engine threads to run the processes of table, with every signal blocked
+struct engine *engine_start(int nworkers, struct proc_table *table, const double *zipf_cum)
+{
+    struct engine *e = malloc(sizeof(struct engine));
+    sigset_t all, old;
+    int i, err = 0;
+
+    if (e == NULL || engine_init(e, nworkers, table, zipf_cum, Clock, Ctl) == -1)
+    {
+        return NULL;
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+        if ((e->workers[i].bell.fd = eventfd(0, EFD_NONBLOCK)) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    Engine = e;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < nworkers && !err; i++)
+    {
+        err = pthread_create(&e->workers[i].thread, NULL, engine_thread, &e->workers[i]);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+    {
+        perror("Master pthread_create");
+        exit(1);
+    }
+    return e;
+}
+
+
+// Stops the engine threads and frees the engine. Returns the number of steps they took between them.
+long engine_stop(struct engine *e)
+{
+    uint64_t one = 1;
+    long steps = 0;
+    int i;
+
+    __atomic_store_n(&e->done, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < e->nworkers; i++)
+    {
+        write(e->workers[i].bell.fd, &one, sizeof(one));
+    }
+    for (i = 0; i < e->nworkers; i++)
+    {
+        pthread_join(e->workers[i].thread, NULL);
+        close(e->workers[i].bell.fd);
+        steps += e->workers[i].steps;
+    }
+    engine_free(e);
+    free(e);
+    Engine = NULL;
+    return steps;
+}
+
+
+// Sets up the processes of table to run as discrete events, choosing resources with the Zipf weights zipf_cum
+struct discrete *discrete_start(struct proc_table *table, const double *zipf_cum)
+{
+    struct discrete *d = calloc(1, sizeof(struct discrete));
+    int i;
+
+    // a pending step for each simpid, a launch and a detection pass
+    if (d == NULL || event_queue_init(&d->events, table->nprocs + 2) == -1 ||
+        (d->procs = calloc(table->nprocs + 1, sizeof(struct sim_process))) == NULL)
+    {
+        return NULL;
+    }
+    d->table = table;
+    for (i = 1; i <= table->nprocs; i++)
+    {
+        if (sim_init(&d->procs[i], table, zipf_cum, Clock) == -1)
+        {
+            return NULL;
+        }
+    }
+    Discrete = d;
+    return d;
+}
+
+
+void discrete_stop(struct discrete *d)
+{
+    int i;
+
+    for (i = 1; i <= d->table->nprocs; i++)
+    {
+        sim_free(&d->procs[i]);
+    }
+    free(d->procs);
+    event_queue_free(&d->events);
+    free(d);
+    Discrete = NULL;
+}
+
+
+// Writer side: writes the state of the discrete-event run d, whose header is h and process table table, to fd.
+// See snapshot.h. Returns 0, or -1 if the write failed.
+int snapshot_write(int fd, struct discrete *d, struct resource_manager *rm, struct snapshot_header *h,
+                   struct proc_table *table)
+{
+    struct snapshot_file sf;
+    struct snapshot_proc proc;
+    struct sim_process *p;
+    int i;
+
+    snapshot_begin(&sf, fd);
+    snapshot_put(&sf, h, sizeof(*h));
+    snapshot_put(&sf, table, proc_table_size(h->nprocs, h->nresources));
+    snapshot_put(&sf, rm->arena, h->arena_bytes);
+    snapshot_put(&sf, slots.free, slots.words * sizeof(uint64_t));
+    snapshot_put(&sf, slots.summary, BITWORDS(slots.words) * sizeof(uint64_t));
+    snapshot_put(&sf, slots.generation, (slots.nslots + 1) * sizeof(unsigned int));
+    snapshot_put(&sf, procarray, (h->nprocs + 1) * sizeof(int));
+    snapshot_put(&sf, d->events.heap, d->events.count * sizeof(struct sim_event));
+    for (i = 1; i <= h->nprocs; i++)
+    {
+        p = &d->procs[i];
+        memset(&proc, 0, sizeof(proc));
+        proc.simpid = p->simpid;
+        proc.generation = p->generation;
+        proc.pid = p->pid;
+        proc.phase = p->phase;
+        proc.rng = p->rng;
+        snapshot_put(&sf, &proc, sizeof(proc));
+        snapshot_put(&sf, p->h.current, h->nresources * sizeof(int));
+        snapshot_put(&sf, p->h.can_request, p->h.words * sizeof(uint64_t));
+        snapshot_put(&sf, p->h.can_release, p->h.words * sizeof(uint64_t));
+    }
+    return snapshot_end(&sf);
+}
+
+
+// Reaps the writer if it has finished, waiting for it if wait is set. Returns 1 if no writer is running.
+int snapshot_reap(bool wait)
+{
+    int status;
+
+    if (Snapshots.writer == 0 || waitpid(Snapshots.writer, &status, wait ? 0 : WNOHANG) == 0)
+    {
+        return Snapshots.writer == 0;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        Snapshots.stats->failed++;
+    }
+    Snapshots.writer = 0;
+    return 1;
+}
+
+
+// Forks a writer for a snapshot of d, unless the last is still being written. run holds where the run is;
+// the rest of the header is filled in here. The writer writes a temporary file and renames it over the last
+// snapshot, so the file at Snapshots.path is always a whole snapshot. The process table is in the region shared
+// with users, which a fork doesn't copy on write, so the writer gets a copy of it made just before.
+void snapshot_take(struct discrete *d, struct resource_manager *rm, struct snapshot_header *run,
+                   struct detection_stats *detection)
+{
+    struct snapshot_stats *stats = Snapshots.stats;
+    char tmp[PATH_MAX];
+    size_t tablebytes = proc_table_size(d->table->nprocs, d->table->nresources);
+    long long started = now_ns(), written;
+    pid_t pid;
+    int fd;
+
+    Snapshots.next_at = started + Snapshots.interval_ns;
+    if (!snapshot_reap(false))
+    {
+        stats->skipped++;
+        return;
+    }
+    memcpy(run->magic, SNAPSHOT_MAGIC, sizeof(run->magic));
+    run->version = SNAPSHOT_VERSION;
+    run->header_size = sizeof(*run);
+    run->seed = d->table->seed;
+    run->skew = d->table->skew;
+    run->batch = d->table->batch;
+    run->terminate = d->table->terminate;
+    run->nprocs = d->table->nprocs;
+    run->nresources = d->table->nresources;
+    run->grant_policy = rm->grant_policy;
+    run->serial = d->serial;
+    run->handled = d->handled;
+    run->steps = d->steps;
+    run->rng = rng;
+    run->events = d->events.count;
+    run->event_seq = d->events.seq;
+    run->arena_bytes = rm_layout(rm, NULL);
+    run->norder = rm->norder;
+    run->epoch = rm->epoch;
+    run->admissions = rm->admissions;
+    run->block_events = rm->block_events;
+    run->grants = rm->grants;
+    run->fast_checks = rm->fast_checks;
+    run->full_checks = rm->full_checks;
+    run->terminations = metrics.terminations;
+    run->denials = metrics.denials;
+    run->stale = metrics.stale;
+    run->messages = metrics.messages;
+    run->units = metrics.units;
+    run->passes = detection->passes;
+    run->deadlocks = detection->deadlocks;
+    run->victims = detection->victims;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", Snapshots.path);
+    if (Snapshots.table == NULL && posix_memalign((void **)&Snapshots.table, CACHELINE, tablebytes) != 0)
+    {
+        perror("Master snapshot table");
+        stats->failed++;
+        return;
+    }
+    memcpy(Snapshots.table, d->table, tablebytes);
+
+    if ((pid = fork()) == -1)
+    {
+        perror("Master snapshot fork");
+        stats->failed++;
+        return;
+    }
+    if (pid == 0)
+    {
+        // the child has the master's memory as it was at the fork, and only writes it out
+        if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1 ||
+            snapshot_write(fd, d, rm, run, Snapshots.table) == -1 || fsync(fd) == -1 || rename(tmp, Snapshots.path) == -1)
+        {
+            _exit(1);
+        }
+        written = now_ns() - started;
+        stats->bytes = lseek(fd, 0, SEEK_CUR);
+        stats->write_ns += written;
+        stats->write_max_ns = written > stats->write_max_ns ? written : stats->write_max_ns;
+        stats->written++;
+        _exit(0);
+    }
+    Snapshots.writer = pid;
+    started = now_ns() - started;
+    stats->taken++;
+    stats->fork_ns += started;
+    stats->fork_max_ns = started > stats->fork_max_ns ? started : stats->fork_max_ns;
+}
+
+
+// Restores the discrete-event run d and the rest of the master from the snapshot open on sf, whose header h has
+// already been read, the resource totals into resource_table and the detection counters into detection.
+// Exits if the snapshot doesn't fit this run or is damaged.
+void snapshot_load(struct snapshot_file *sf, struct snapshot_header *h, struct discrete *d,
+                   struct resource_manager *rm, int *resource_table, struct detection_stats *detection)
+{
+    struct snapshot_proc proc;
+    struct sim_process *p;
+    int i;
+
+    if (h->arena_bytes != rm_layout(rm, NULL) || h->events > INT_MAX / sizeof(struct sim_event))
+    {
+        printf("Error, the snapshot's tables don't match its dimensions!\n");
+        exit(1);
+    }
+    snapshot_get(sf, d->table, proc_table_size(h->nprocs, h->nresources));
+    snapshot_get(sf, rm->arena, h->arena_bytes);
+    // the queues' heaps are the only pointers in the arena
+    for (i = 0; i < h->nresources; i++)
+    {
+        rm->queues[i].heap = rm->queue_slots + (size_t)i * (h->nprocs + 1);
+    }
+    memcpy(resource_table, rm->total, h->nresources * sizeof(int));
+    rm->norder = h->norder;
+    rm->epoch = h->epoch;
+    rm->admissions = h->admissions;
+    rm->block_events = h->block_events;
+    rm->grants = h->grants;
+    rm->fast_checks = h->fast_checks;
+    rm->full_checks = h->full_checks;
+    snapshot_get(sf, slots.free, slots.words * sizeof(uint64_t));
+    snapshot_get(sf, slots.summary, BITWORDS(slots.words) * sizeof(uint64_t));
+    snapshot_get(sf, slots.generation, (slots.nslots + 1) * sizeof(unsigned int));
+    snapshot_get(sf, procarray, (h->nprocs + 1) * sizeof(int));
+    while (d->events.capacity < (int)h->events)
+    {
+        if ((d->events.heap = realloc(d->events.heap, 2 * d->events.capacity * sizeof(struct sim_event))) == NULL)
+        {
+            perror("Master snapshot events");
+            exit(1);
+        }
+        d->events.capacity *= 2;
+    }
+    snapshot_get(sf, d->events.heap, h->events * sizeof(struct sim_event));
+    d->events.count = h->events;
+    d->events.seq = h->event_seq;
+    for (i = 1; i <= h->nprocs; i++)
+    {
+        p = &d->procs[i];
+        snapshot_get(sf, &proc, sizeof(proc));
+        p->simpid = proc.simpid;
+        p->generation = proc.generation;
+        p->pid = proc.pid;
+        p->phase = proc.phase;
+        p->rng = proc.rng;
+        p->claims = proc_table_row(d->table, i);
+        snapshot_get(sf, p->h.current, h->nresources * sizeof(int));
+        snapshot_get(sf, p->h.can_request, p->h.words * sizeof(uint64_t));
+        snapshot_get(sf, p->h.can_release, p->h.words * sizeof(uint64_t));
+    }
+    if (snapshot_check(sf) == -1)
+    {
+        printf("Error, the snapshot is damaged, its checksum doesn't match!\n");
+        exit(1);
+    }
+    close(sf->fd);
+    d->serial = h->serial;
+    d->handled = h->handled;
+    d->steps = h->steps;
+    rng = h->rng;
+    *Clock = h->clock;
+    metrics.terminations = h->terminations;
+    metrics.denials = h->denials;
+    metrics.stale = h->stale;
+    metrics.messages = h->messages;
+    metrics.units = h->units;
+    detection->passes = h->passes;
+    detection->deadlocks = h->deadlocks;
+    detection->victims = h->victims;
+    // a blocked request's wait is timed from the restore, the wall time it waited before is gone
+    for (i = 1; i <= h->nprocs; i++)
+    {
+        if (bit_test(rm->blocked, i))
+        {
+            metrics.requested_at[i] = now_ns();
+        }
+    }
+}
+
+
+// Prints what snapshots cost the run
+void report_snapshots(struct snapshot_stats *stats)
+{
+    printf("Snapshots: %ld written to %s, %ld failed, %ld skipped while one was being written, %llu bytes each; "
+           "forking %.1f us on average, %.1f us at most (the pause the run sees); writing %.2f ms on average, "
+           "%.2f ms at most\n", stats->written, Snapshots.path, stats->failed, stats->skipped,
+           (unsigned long long)stats->bytes, stats->taken ? stats->fork_ns / 1e3 / stats->taken : 0.0,
+           stats->fork_max_ns / 1e3, stats->written ? stats->write_ns / 1e6 / stats->written : 0.0,
+           stats->write_max_ns / 1e6);
+}
+
+
+// Starts a process in a free simpid at simulated time now, with a maximum claim drawn from the master's stream.
+// Returns the simpid, or -1 if there is none free: killed victims may be waiting to be reaped.
+int start_process(struct resource_manager *rm, struct proc_table *table, struct launch_stats *launches, uint64_t now)
+{
+    struct mesg_buf launch;
+    long long started;
+    int simpid, i;
+    pid_t pid;
+
+    if ((simpid = slot_alloc(&slots)) == -1)
+    {
+        return -1;
+    }
+    TRACE(TRACE_DEBUG, "Time to launch a new process\n");
+    for (i = 0; i < table->nresources; i++)
+    {
+        proc_table_row(table, simpid)[i] = prng_below(&rng, MAXCLAIM);
+    }
+    rm_admit(rm, simpid);
+    if (Shards != NULL)
+    {
+        shard_lock_all(Shards);
+        shard_admit(Shards, simpid, proc_table_row(table, simpid));
+        shard_unlock_all(Shards);
+    }
+    started = now_ns();
+    // in the pipeline a forked user's pid is 0 until the spawner reports it, see pipeline_collect
+    pid = launch_process(simpid);
+    launches->launched_at[simpid] = now_ns();
+    launches->launch_ns += launches->launched_at[simpid] - started;
+    launches->launches++;
+    procarray[simpid] = pid;
+    if (recording != NULL)
+    {
+        memset(&launch, 0, sizeof(launch));
+        launch.pid = pid;
+        launch.generation = slots.generation[simpid];
+        replay_write(recording, REPLAY_LAUNCH, simpid, now, readClock(Clock), &launch, proc_table_row(table, simpid),
+                     table->nresources);
+    }
+    //log process creation
+    if (pid != 0)
+    {
+        log_event(EV_CREATE, now, pid, simpid, 0, 0);
+    }
+    else
+    {
+        Pipeline->launched_sim[simpid] = now;
+    }
+    return simpid;
+}
+
+
+// Replies to every blocked request that can be granted now that something has been released
+void wake_waiters(struct resource_manager *rm)
+{
+    struct mesg_buf granted;
+    int j;
+
+    while (rm_wake(rm, &granted))
+    {
+        for (j = 0; j < granted.nitems; j++)
+        {
+            hist_record(&metrics.blocked[granted.items[j].resource], readClock(Clock) - granted.timestamp);
+            metrics.units += granted.items[j].count;
+        }
+        hist_record(&metrics.unblocked, readClock(Clock) - granted.timestamp);
+        record_grant(&metrics, &granted, metrics.requested_at[granted.simpid]);
+        log_batch(EV_UNBLOCK, readClock(Clock), &granted, 0);
+        send_reply(&granted);
+    }
+}
+
+
+// Logs and counts what became of a request in the shards, as handle_message and wake_waiters do for the
+// master's own resource manager. Only the master loop calls it.
+void shard_record(struct shard_outcome *out)
+{
+    struct mesg_buf *msg = &out->msg;
+    int depth, j;
+
+    if (out->result == SHARD_RELEASED)
+    {
+        log_batch(EV_RELEASE, out->clock, msg, 0);
+        metrics.messages++;
+        for (j = 0; j < msg->nitems; j++)
+        {
+            metrics.units += msg->items[j].count;
+        }
+        return;
+    }
+    if (out->result == SHARD_UNBLOCKED)
+    {
+        for (j = 0; j < msg->nitems; j++)
+        {
+            hist_record(&metrics.blocked[msg->items[j].resource], out->clock - msg->timestamp);
+            metrics.units += msg->items[j].count;
+        }
+        hist_record(&metrics.unblocked, out->clock - msg->timestamp);
+        record_wait(&metrics, msg->simpid, out->clock - msg->timestamp, out->at - out->received);
+        log_batch(EV_UNBLOCK, out->clock, msg, 0);
+        metrics.rm->grants++;
+        return;
+    }
+    log_batch(EV_REQUEST, out->clock, msg, out->result);
+    metrics.messages++;
+    if (out->result == GRANTED)
+    {
+        for (j = 0; j < msg->nitems; j++)
+        {
+            metrics.units += msg->items[j].count;
+        }
+        record_wait(&metrics, msg->simpid, out->clock - msg->timestamp, out->at - out->received);
+        metrics.rm->grants++;
+    }
+    else if (out->result == BLOCKED)
+    {
+        metrics.rm->block_events++;
+        metrics.requested_at[msg->simpid] = out->received;
+        depth = __atomic_load_n(&Shards->nblocked, __ATOMIC_RELAXED);
+        metrics.depth_samples++;
+        metrics.depth_total += depth;
+        if (depth > metrics.depth_max)
+        {
+            metrics.depth_max = depth;
+        }
+    }
+    else
+    {
+        metrics.denials++;
+    }
+}
+
+
+// Hands the master what became of a request. A shard thread passes it through its outcomes queue, and wakes
+// the master when a request blocks, since every process being blocked calls for a detection pass right away.
+// On the master (outcomes NULL) it is recorded on the spot.
+void shard_report(struct spsc_queue *outcomes, struct shard_request *req, int result)
+{
+    struct shard_outcome out;
+
+    out.msg = req->msg;
+    out.result = result;
+    out.received = req->received;
+    out.clock = readClock(Clock);
+    out.at = now_ns();
+    if (outcomes == NULL)
+    {
+        shard_record(&out);
+        return;
+    }
+    // the master drains the queues every time round its loop, and each simpid has at most a request or two
+    // in them, so it is only ever full for a moment
+    while (!spsc_push(outcomes, &out))
+    {
+        sched_yield();
+    }
+    if (result == BLOCKED)
+    {
+        if (Pipeline != NULL)
+        {
+            bell_ring(&Pipeline->master_bell);
+        }
+        else
+        {
+            doorbell_ring(Ctl);
+        }
+    }
+}
+
+
+// Records that req has to wait in a shard, the first time it does
+void shard_block(struct shard_set *set, struct shard_request *req, struct spsc_queue *outcomes)
+{
+    __atomic_add_fetch(&set->nblocked, 1, __ATOMIC_RELAXED);
+    if (!req->blocked)
+    {
+        req->blocked = 1;
+        shard_report(outcomes, req, BLOCKED);
+    }
+}
+
+
+// Carries a request on from shard s, where its part has just been granted, through the shards above it in
+// ascending order, taking each one's lock before letting go of the last. It either ends up waiting in one of
+// them or is granted in full and answered. The caller holds s, or every shard if all_locked.
+void shard_advance(struct shard_set *set, struct shard_request *req, int s, bool all_locked,
+                   struct spsc_queue *outcomes)
+{
+    struct mesg_buf part;
+    int held = s;
+    int t, result;
+
+    for (t = shard_next(set, &req->msg, s); t != -1; t = shard_next(set, &req->msg, t))
+    {
+        if (!all_locked)
+        {
+            pthread_mutex_lock(&set->shards[t].lock);
+            if (held != s)
+            {
+                pthread_mutex_unlock(&set->shards[held].lock);
+            }
+            held = t;
+        }
+        shard_part(set, &req->msg, t, &part);
+        result = rm_request(&set->shards[t].rm, &part);
+        if (result == BLOCKED)
+        {
+            shard_block(set, req, outcomes);
+            break;
+        }
+    }
+    if (held != s)
+    {
+        pthread_mutex_unlock(&set->shards[held].lock);
+    }
+    if (t != -1)
+    {
+        return;
+    }
+    // reported before the reply: once the user has it, it can send the request that replaces req
+    shard_report(outcomes, req, req->blocked ? SHARD_UNBLOCKED : GRANTED);
+    send_reply(&req->msg);
+}
+
+
+// Carries on every request waiting in shard s that can be granted there now that something has been handed
+// back. The caller holds s, or every shard if all_locked.
+void shard_wake(struct shard_set *set, int s, bool all_locked, struct spsc_queue *outcomes)
+{
+    struct mesg_buf part;
+
+    while (rm_wake(&set->shards[s].rm, &part))
+    {
+        __atomic_sub_fetch(&set->nblocked, 1, __ATOMIC_RELAXED);
+        shard_advance(set, &set->inflight[part.simpid], s, all_locked, outcomes);
+    }
+}
+
+
+// Starts a request in s, the lowest shard it spans, whose lock the caller holds. It is checked against the
+// process's claims in every shard first, so it can't be refused halfway through.
+void shard_take_request(struct shard_set *set, int s, struct shard_request *req, struct spsc_queue *outcomes)
+{
+    struct mesg_buf part;
+    int t, j, result;
+
+    for (t = shard_next(set, &req->msg, s); t != -1; t = shard_next(set, &req->msg, t))
+    {
+        pthread_mutex_lock(&set->shards[t].lock);
+    }
+    result = shard_check(set, &req->msg);
+    for (t = shard_next(set, &req->msg, s); t != -1; t = shard_next(set, &req->msg, t))
+    {
+        pthread_mutex_unlock(&set->shards[t].lock);
+    }
+    if (result == DENIED)
+    {
+        shard_report(outcomes, req, DENIED);
+        for (j = 0; j < req->msg.nitems; j++)
+        {
+            req->msg.items[j].count = 0;
+        }
+        send_reply(&req->msg);
+        return;
+    }
+    shard_part(set, &req->msg, s, &part);
+    if (rm_request(&set->shards[s].rm, &part) == BLOCKED)
+    {
+        shard_block(set, req, outcomes);
+        return;
+    }
+    shard_advance(set, req, s, false, outcomes);
+}
+
+
+// Carries out a release one shard at a time, handing what comes back to that shard's waiters. A release never
+// waits, so it needs no more than one lock at a time.
+void shard_release(struct shard_set *set, struct shard_request *req, struct spsc_queue *outcomes)
+{
+    struct mesg_buf *msg = &req->msg;
+    struct resource_manager *srm;
+    int j, r, t;
+
+    for (j = 0; j < msg->nitems; j++)
+    {
+        if (msg->items[j].resource < 0 || msg->items[j].resource >= set->nresources)
+        {
+            msg->items[j].count = 0;
+        }
+    }
+    for (t = shard_next(set, msg, -1); t != -1; t = shard_next(set, msg, t))
+    {
+        srm = &set->shards[t].rm;
+        pthread_mutex_lock(&set->shards[t].lock);
+        for (j = 0; j < msg->nitems; j++)
+        {
+            r = msg->items[j].resource;
+            if (r >= 0 && r < set->nresources && SHARD_OF(set, r) == t)
+            {
+                msg->items[j].count = rm_release(srm, msg->simpid, SHARD_LOCAL(set, r), msg->items[j].count);
+            }
+        }
+        shard_wake(set, t, false, outcomes);
+        pthread_mutex_unlock(&set->shards[t].lock);
+    }
+    shard_report(outcomes, req, SHARD_RELEASED);
+    send_reply(msg);
+}
+
+
+// Takes simpid out of the shards for good and lets the waiters have what it held. The caller holds every
+// shard's lock if all_locked.
+void shard_retire(struct shard_set *set, int simpid, bool all_locked)
+{
+    int s;
+
+    if (!all_locked)
+    {
+        shard_lock_all(set);
+    }
+    shard_terminate(set, simpid);
+    for (s = 0; s < set->nshards; s++)
+    {
+        shard_wake(set, s, true, NULL);
+    }
+    if (!all_locked)
+    {
+        shard_unlock_all(set);
+    }
+}
+
+
+// Passes a request or release to the lowest shard it spans. Returns 0 if it names no resource at all,
+// which leaves it to the master.
+int shard_route(struct shard_set *set, struct mesg_buf *msg, long long received)
+{
+    struct shard_request *req = &set->inflight[msg->simpid];
+    int s = shard_next(set, msg, -1);
+
+    if (s == -1)
+    {
+        return 0;
+    }
+    if (shard_next(set, msg, s) != -1)
+    {
+        set->spanning++;
+    }
+    set->routed++;
+    req->msg = *msg;
+    req->received = received;
+    req->blocked = 0;
+    // at most one request per simpid is ever in flight, so the inbox has room
+    spsc_push(&set->shards[s].inbox, &msg->simpid);
+    bell_ring(&set->shards[s].bell);
+    return 1;
+}
+
+
+// Records everything the shard threads have reported
+void shard_collect(struct shard_set *set)
+{
+    struct shard_outcome out;
+    int s;
+
+    for (s = 0; s < set->nshards; s++)
+    {
+        while (spsc_pop(&set->shards[s].outcomes, &out))
+        {
+            shard_record(&out);
+        }
+    }
+}
+
+
+// A shard's thread: starts the requests and carries out the releases the master routes to its shard
+static void *shard_thread(void *arg)
+{
+    struct shard *sh = arg;
+    int s = sh - Shards->shards;
+    struct shard_request *req;
+    struct pollfd fd;
+    int simpid;
+
+    fd.fd = sh->bell.fd;
+    fd.events = POLLIN;
+    while (!__atomic_load_n(&Shards->done, __ATOMIC_ACQUIRE))
+    {
+        if (spsc_pop(&sh->inbox, &simpid))
+        {
+            req = &Shards->inflight[simpid];
+            if (req->msg.opcode == RELEASE)
+            {
+                shard_release(Shards, req, &sh->outcomes);
+            }
+            else
+            {
+                pthread_mutex_lock(&sh->lock);
+                shard_take_request(Shards, s, req, &sh->outcomes);
+                pthread_mutex_unlock(&sh->lock);
+            }
+            continue;
+        }
+        bell_arm(&sh->bell);
+        if (spsc_empty(&sh->inbox))
+        {
+            poll(&fd, 1, IDLE_TIMEOUT_MS);
+        }
+        bell_clear(&sh->bell);
+    }
+    return NULL;
+}
+
+
+// Splits the resource classes into nshards shards and starts a thread for each, with every signal blocked
+struct shard_set *sharding_start(int nshards, int nresources, int *total, int grant_policy)
+{
+    struct shard_set *set = malloc(sizeof(struct shard_set));
+    sigset_t all, old;
+    int s, err = 0;
+
+    if (set == NULL || shard_set_init(set, nshards, nprocs, nresources, total, grant_policy) == -1)
+    {
+        return NULL;
+    }
+    for (s = 0; s < nshards; s++)
+    {
+        if ((set->shards[s].bell.fd = eventfd(0, EFD_NONBLOCK)) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    Shards = set;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (s = 0; s < nshards && !err; s++)
+    {
+        err = pthread_create(&set->shards[s].thread, NULL, shard_thread, &set->shards[s]);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+    {
+        perror("Master pthread_create");
+        exit(1);
+    }
+    return set;
+}
+
+
+// Stops the shard threads, records what they reported last and frees the shards
+void sharding_stop(struct shard_set *set)
+{
+    uint64_t one = 1;
+    int s;
+
+    __atomic_store_n(&set->done, 1, __ATOMIC_RELEASE);
+    for (s = 0; s < set->nshards; s++)
+    {
+        write(set->shards[s].bell.fd, &one, sizeof(one));
+    }
+    for (s = 0; s < set->nshards; s++)
+    {
+        pthread_join(set->shards[s].thread, NULL);
+        close(set->shards[s].bell.fd);
+    }
+    shard_collect(set);
+    shard_set_free(set);
+    free(set);
+    Shards = NULL;
+}
+
+
+// Runs one deadlock detection pass. While the wait-for graph still has a deadlocked set, a victim is chosen
+// from it by policy and killed, and whatever it held is handed to the waiters it was blocking.
+// Returns the number of processes killed.
+int detection_pass(struct resource_manager *rm, int policy, uint64_t now,
+                   struct detection_stats *stats)
+{
+    uint64_t dead[rm->procwords];
+    uint64_t waits_for[rm->procwords];
+    struct timespec start, end;
+    long long elapsed;
+    int ndead, victim, p, q, first;
+    int killed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // the shards stand still for the whole pass, and the master's manager is brought up to date with them
+    if (Shards != NULL)
+    {
+        shard_lock_all(Shards);
+        shard_sync(Shards, rm);
+    }
+    ndead = rm_detect(rm, dead);
+    if (ndead > 0)
+    {
+        stats->deadlocks++;
+    }
+    while (ndead > 0)
+    {
+        victim = rm_choose_victim(rm, dead, policy);
+        log_event(EV_DEADLOCK, now, 0, 0, ndead, 0);
+        for (p = bit_next(dead, rm->procwords, 0); p != -1; p = bit_next(dead, rm->procwords, p + 1))
+        {
+            rm_waits_for(rm, p, dead, waits_for);
+            log_event(EV_WAITER, now, 0, p, 0, 0);
+            first = bit_next(waits_for, rm->procwords, 0);
+            for (q = first; q != -1; q = bit_next(waits_for, rm->procwords, q + 1))
+            {
+                log_event(EV_WAITS_FOR, now, 0, q, q == first, 0);
+            }
+        }
+        log_event(EV_KILL, now, procarray[victim], victim, 0, 0);
+        // with shards the master's manager only has a copy of who is blocked, the wait is cancelled in the
+        // owning shard by shard_retire
+        if (Shards == NULL)
+        {
+            rm_cancel_wait(rm, victim);
+        }
+        rm_terminate(rm, victim);
+        if (Engine != NULL || Discrete != NULL)
+        {
+            // the task is gone before its thread takes the next launch for the simpid off the same queue. A
+            // discrete-event victim has no step pending: it is blocked, and nothing is due until its reply.
+            if (Engine != NULL)
+            {
+                engine_command(Engine, ENGINE_KILL, victim, 0, 0, NULL);
+            }
+            procarray[victim] = 0;
+            slot_free(&slots, victim);
+        }
+        else
+        {
+            if (!replaying)
+            {
+                kill(procarray[victim], SIGUSR1);
+            }
+            // the simpid stays reserved until reap_children sees the victim exit. The victim is still blocked
+            // in msgrcv on its reply type until then, and msgsnd hands a message straight to a blocked
+            // receiver, so it would swallow the first reply meant for a new process with the same simpid.
+            procarray[victim] = -procarray[victim];
+            unreaped++;
+            slot_retire(&slots, victim);
+        }
+        killed++;
+        if (Shards != NULL)
+        {
+            shard_retire(Shards, victim, true);
+            shard_sync(Shards, rm);
+        }
+        else
+        {
+            wake_waiters(rm);
+        }
+        ndead = rm_detect(rm, dead);
+    }
+    if (Shards != NULL)
+    {
+        shard_unlock_all(Shards);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) * (long long)BILLION + (end.tv_nsec - start.tv_nsec);
+    stats->passes++;
+    stats->victims += killed;
+    stats->total_ns += elapsed;
+    log_event(EV_DETECTION, now, 0, 0, killed, elapsed);
+    return killed;
+}
+
+
+// Acts on one request, release or termination from a user, received at wall time received.
+// totalprocs is the number of processes running.
+void handle_message(struct resource_manager *rm, struct mesg_buf *msg, uint64_t now, long long received,
+                    int *totalprocs, int sigfd)
+{
+    int result, depth, j;
+
+    TRACE(TRACE_DEBUG, "message received from process %d: %d %d, %d pairs\n", msg->simpid, msg->pid,
+          msg->opcode, msg->nitems);
+    // a malformed batch is denied, and the reply never claims more pairs than a message holds
+    if (msg->nitems < 0 || msg->nitems > MAXBATCH || msg->opcode == TERMINATE)
+    {
+        msg->nitems = 0;
+    }
+    if (msg->opcode == TERMINATE)
+    {
+        log_event(EV_TERMINATE, now, msg->pid, msg->simpid, 0, 0);
+        rm_terminate(rm, msg->simpid);
+        if (Shards != NULL)
+        {
+            shard_retire(Shards, msg->simpid, false);
+        }
+        // like a victim's, the simpid is held back until the process is reaped: it may not have got as far as
+        // msgrcv for this reply yet, and a new process with the same simpid could take the reply in its place.
+        // A pool worker lives on as the simpid, and an engine task or a discrete-event process takes the reply
+        // before the next launch, so their simpids are free at once.
+        if (Pool == NULL && Engine == NULL && Discrete == NULL && !replaying)
+        {
+            procarray[msg->simpid] = -procarray[msg->simpid];
+            unreaped++;
+            slot_retire(&slots, msg->simpid);
+        }
+        else
+        {
+            procarray[msg->simpid] = 0;
+            slot_free(&slots, msg->simpid);
+        }
+        (*totalprocs)--;
+        log_event(EV_TOTALPROCS, now, 0, 0, *totalprocs, 0);
+        metrics.terminations++;
+        send_reply(msg);
+        wake_waiters(rm);
+        reap_children(sigfd);
+    }
+    else if (Shards != NULL && shard_route(Shards, msg, received))
+    {
+        // the shards answer it and report back, see shard_collect
+    }
+    else if (msg->opcode == REQUEST)
+    {
+        // a request naming no resource never gets as far as a shard
+        result = Shards != NULL ? DENIED : rm_request(rm, msg);
+        log_batch(EV_REQUEST, now, msg, result);
+        metrics.messages++;
+        if (result == BLOCKED)
+        {
+            metrics.requested_at[msg->simpid] = received;
+            depth = bit_count(rm->blocked, rm->procwords);
+            metrics.depth_samples++;
+            metrics.depth_total += depth;
+            if (depth > metrics.depth_max)
+            {
+                metrics.depth_max = depth;
+            }
+        }
+        else
+        {
+            // a denied request is answered with counts of 0 so the user knows it holds nothing new
+            if (result == DENIED)
+            {
+                for (j = 0; j < msg->nitems; j++)
+                {
+                    msg->items[j].count = 0;
+                }
+                metrics.denials++;
+            }
+            else
+            {
+                for (j = 0; j < msg->nitems; j++)
+                {
+                    metrics.units += msg->items[j].count;
+                }
+                record_grant(&metrics, msg, received);
+            }
+            send_reply(msg);
+        }
+    }
+    else
+    {
+        log_batch(EV_RELEASE, now, msg, 0);
+        metrics.messages++;
+        for (j = 0; j < msg->nitems; j++)
+        {
+            msg->items[j].count = rm_release(rm, msg->simpid, msg->items[j].resource, msg->items[j].count);
+            metrics.units += msg->items[j].count;
+        }
+        send_reply(msg);
+        wake_waiters(rm);
+    }
+}
+
+
+// Feeds a recorded trace back through the master in the order it was recorded, with the clock set to each
+// record's reading, and no user processes. Returns the number of records replayed.
+long replay_trace(FILE *trace, struct resource_manager *rm, struct proc_table *table, int policy,
+                  struct detection_stats *detection, struct launch_stats *launches)
+{
+    struct replay_record rec;
+    int claims[table->nresources];
+    int totalprocs = 0;
+    long records = 0;
+
+    while (!stop_requested && replay_read(trace, &rec, claims, table->nresources))
+    {
+        __atomic_store_n(Clock, rec.clock, __ATOMIC_RELAXED);
+        records++;
+        if (rec.type == REPLAY_LAUNCH)
+        {
+            memcpy(proc_table_row(table, rec.simpid), claims, table->nresources * sizeof(int));
+            rm_admit(rm, rec.simpid);
+            slots.generation[rec.simpid] = rec.msg.generation;
+            procarray[rec.simpid] = rec.msg.pid;
+            totalprocs++;
+            launches->launches++;
+            if (rec.msg.pid != 0)
+            {
+                log_event(EV_CREATE, rec.now, rec.msg.pid, rec.simpid, 0, 0);
+            }
+        }
+        else if (rec.type == REPLAY_SPAWNED)
+        {
+            procarray[rec.simpid] = rec.msg.pid;
+            log_event(EV_CREATE, rec.now, rec.msg.pid, rec.simpid, 0, 0);
+        }
+        else if (rec.type == REPLAY_DETECT)
+        {
+            totalprocs -= detection_pass(rm, policy, rec.now, detection);
+        }
+        else
+        {
+            handle_message(rm, &rec.msg, rec.now, now_ns(), &totalprocs, -1);
+        }
+    }
+    return records;
+}
+
+
+// Runs the simulation as discrete events until the clock reaches end. Nothing spins the clock forward: it jumps
+// straight to the earliest event, whether a launch falling due, a process's slice of work coming to an end
+// WORKCONSTANT after it began, or a detection pass every detectms. A process's message is handled the moment
+// it is sent, and its reply schedules its next step for the same time. Launches follow the rule of the master
+// loop, checked after every event since a termination or a kill can make room. A run restored from a snapshot
+// (resume not NULL) has its events queued already, and picks up from where the snapshot left it.
+void run_discrete(struct discrete *d, struct resource_manager *rm, struct proc_table *table, int launchms,
+                  int detectms, int policy, uint64_t end, struct detection_stats *detection,
+                  struct launch_stats *launches, struct snapshot_header *resume)
+{
+    struct mesg_buf msg;
+    struct sim_event ev;
+    struct snapshot_header run;
+    uint64_t now = readClock(Clock);
+    uint64_t nextTime = resume != NULL ? resume->next_launch : now;
+    int totalprocs = resume != NULL ? resume->totalprocs : 0;
+
+    memset(&run, 0, sizeof(run));
+    run.launchms = launchms;
+    run.detectms = detectms;
+    run.policy = policy;
+    run.end = end;
+    Snapshots.next_at = now_ns() + Snapshots.interval_ns;
+    if (resume == NULL)
+    {
+        discrete_schedule(d, now, EVENT_LAUNCH, 0, 0);
+    }
+    // the master loop also runs a pass as soon as every process is blocked, because then nobody moves the
+    // clock. Here the clock moves on to the next launch or pass regardless.
+    if (detectms > 0 && resume == NULL)
+    {
+        discrete_schedule(d, now + (uint64_t)detectms * MILLISEC, EVENT_DETECT, 0, 0);
+    }
+    while (!stop_requested && event_pop(&d->events, &ev) && ev.time < end)
+    {
+        d->handled++;
+        // a launch moves the clock 100ns on, past anything already due then
+        if (ev.time > now)
+        {
+            __atomic_store_n(Clock, ev.time, __ATOMIC_RELAXED);
+            now = ev.time;
+        }
+        if (dump_requested)
+        {
+            dump_requested = 0;
+            dump_metrics(&metrics);
+        }
+        if (ev.kind == EVENT_STEP && slot_current(&slots, ev.simpid, ev.generation))
+        {
+            d->steps++;
+            switch (sim_step(&d->procs[ev.simpid], &msg))
+            {
+                case SIM_WORK:
+                    discrete_schedule(d, now + WORKCONSTANT, EVENT_STEP, ev.simpid, ev.generation);
+                    break;
+                case SIM_SEND:
+                    if (recording != NULL)
+                    {
+                        replay_write(recording, REPLAY_MESSAGE, msg.simpid, now, now, &msg, NULL, 0);
+                    }
+                    handle_message(rm, &msg, now, now_ns(), &totalprocs, -1);
+                    break;
+            }
+        }
+        else if (ev.kind == EVENT_DETECT)
+        {
+            if (recording != NULL)
+            {
+                replay_write(recording, REPLAY_DETECT, 0, now, now, NULL, NULL, 0);
+            }
+            totalprocs -= detection_pass(rm, policy, now, detection);
+            discrete_schedule(d, now + (uint64_t)detectms * MILLISEC, EVENT_DETECT, 0, 0);
+        }
+        // an EVENT_LAUNCH only brings the clock to nextTime. One left over from before a launch that room made
+        // possible early finds nothing to do.
+        if ((totalprocs == 0 || (now >= nextTime && totalprocs < nprocs)) &&
+            start_process(rm, table, launches, now) != -1)
+        {
+            totalprocs++;
+            now = advanceClock(Clock, 100);
+            nextTime = getNextProcTime(now, launchms);
+            discrete_schedule(d, nextTime, EVENT_LAUNCH, 0, 0);
+        }
+        // the event just handled is done with and every later one is queued, so this is a whole state to take
+        if (Snapshots.path != NULL && (d->handled & SNAPSHOT_EVERY) == 0 && now_ns() >= Snapshots.next_at)
+        {
+            run.clock = now;
+            run.next_launch = nextTime;
+            run.totalprocs = totalprocs;
+            snapshot_take(d, rm, &run, detection);
+        }
+    }
+    if (Snapshots.path != NULL)
+    {
+        snapshot_reap(true);
+    }
+}
+
+
+// Prints how many requests were granted per second of wall time
+void report_throughput(struct resource_manager *rm, struct timespec *wallstart)
+{
+    struct timespec wallend;
+    double wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &wallend);
+    wall = (wallend.tv_sec - wallstart->tv_sec) + (wallend.tv_nsec - wallstart->tv_nsec) / 1e9;
+    printf("Throughput: %ld requests granted, %ld had to wait, %.0f grants per wall second\n", rm->grants,
+           rm->block_events, wall > 0 ? rm->grants / wall : 0.0);
+}
+
+
+// Prints how fast the simulation ran: the simulated time covered and the events logged, per second of wall time
+void report_sim_rate(struct timespec *wallstart)
+{
+    struct timespec wallend;
+    double wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &wallend);
+    wall = (wallend.tv_sec - wallstart->tv_sec) + (wallend.tv_nsec - wallstart->tv_nsec) / 1e9;
+    printf("Simulation: %.3f simulated seconds and %u events in %.3f wall seconds, %.0f events per wall second\n",
+           readClock(Clock) / 1e9, eventlog.head, wall, wall > 0 ? eventlog.head / wall : 0.0);
+}
+
+
+// Prints what launching processes cost the master, and how long they took to get their first request in
+void report_launches(struct launch_stats *stats)
+{
+    double launch_us = stats->launches ? stats->launch_ns / 1e3 / stats->launches : 0.0;
+
+    printf("Launches: %ld processes, %.1f us each in the master (%.0f launches per second), "
+           "%.1f us from launch to first request on average\n", stats->launches, launch_us,
+           launch_us > 0 ? 1e6 / launch_us : 0.0,
+           stats->first_requests ? stats->first_request_ns / 1e3 / stats->first_requests : 0.0);
+}
+
+
+// Prints the master's CPU time over the run and returns it in seconds
+double report_cpu_usage(struct timespec *wallstart)
+{
+    struct rusage usage;
+    struct timespec wallend, thread;
+    double wall, user, sys;
+
+    getrusage(RUSAGE_SELF, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &wallend);
+    wall = (wallend.tv_sec - wallstart->tv_sec) + (wallend.tv_nsec - wallstart->tv_nsec) / 1e9;
+    user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    printf("Master CPU: %.3fs user, %.3fs system over %.3fs wall (%.1f%%)\n", user, sys, wall,
+           wall > 0 ? 100.0 * (user + sys) / wall : 0.0);
+    // the process total includes the log writer and, with -P, the receivers and the spawner
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread);
+    printf("Master loop thread CPU: %.3fs\n", thread.tv_sec + thread.tv_nsec / 1e9);
+    return user + sys;
+}
+
+
+// Prints how many instances each request or release moved, and the master CPU each instance cost
+void report_units(struct metrics *m, double cpu)
+{
+    printf("Moved %ld instances in %ld requests and releases (%.2f per message), %.0f ns of master CPU each\n",
+           m->units, m->messages, m->messages ? (double)m->units / m->messages : 0.0,
+           m->units ? cpu * BILLION / m->units : 0.0);
+}
+
+
+// A run of a sweep that is going on
+struct sweep_run {
+    pid_t pid;                  // 0 if the slot is free
+    long run;
+    long long started;
+    char options[256];          // its options from the grid
+    char cpus[256];             // its core group
+};
+
+
+// Writes the JSON line for a finished run of a sweep to results, with the metrics it wrote embedded
+void sweep_result(FILE *results, struct sweep_run *r, const char *metricspath, int status, struct rusage *usage)
+{
+    FILE *fp = fopen(metricspath, "r");
+    long long wall = now_ns() - r->started;
+    int ch, last = 0;
+
+    fprintf(results, "{\"run\": %ld, \"options\": \"%s\", \"cpus\": \"%s\", \"exit\": %d, \"wall_ns\": %lld, "
+            "\"cpu_ns\": %.0f, \"peak_rss_kb\": %ld, \"metrics\": ", r->run, r->options, r->cpus,
+            WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), wall,
+            (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1e9 +
+            (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1e3, usage->ru_maxrss);
+    if (fp == NULL)
+    {
+        fprintf(results, "null}\n");
+        return;
+    }
+    // the metrics file is one JSON object over many lines, folded onto this one
+    while ((ch = fgetc(fp)) != EOF)
+    {
+        if (ch == '\n')
+        {
+            ch = ' ';
+        }
+        if (ch != ' ' || last != ' ')
+        {
+            fputc(ch, results);
+        }
+        last = ch;
+    }
+    fclose(fp);
+    unlink(metricspath);
+    fprintf(results, "}\n");
+    fflush(results);
+}
+
+
+// Runs OSS once for every combination of grid, with the options in base and the combination's, jobs runs at a
+// time (one per CPU for 0), each in a session of its own pinned to its own core group. Run k logs to logname.k and
+// prints to logname.k.out, records its trace to recordfile.k if recordfile isn't NULL, and its line goes to results
+// as it finishes. Returns the number of runs that failed.
+int run_sweep(struct sweep_grid *grid, char **base, int nbase, int jobs, const char *logname, const char *recordfile,
+              const char *results)
+{
+    int cpus[SWEEP_MAX_CPUS];
+    uint64_t mask[SWEEP_MASK_WORDS];
+    char logpath[PATH_MAX], outpath[PATH_MAX], metricspath[PATH_MAX], recordpath[PATH_MAX];
+    char *args[nbase + 2 * MAX_AXES + 8];
+    struct sweep_run *slots;
+    struct rusage usage;
+    FILE *out;
+    long run = 0;
+    int ncpus, nargs, slot, running = 0, failed = 0, status, fd;
+    pid_t pid;
+
+    ncpus = sweep_cpus(cpus);
+    jobs = jobs > 0 ? jobs : ncpus;
+    if ((out = fopen(results, "w")) == NULL || (slots = calloc(jobs, sizeof(struct sweep_run))) == NULL)
+    {
+        perror("Sweep results");
+        return 1;
+    }
+    printf("Sweeping %ld runs, %d at a time on %d CPUs, results to %s\n", grid->runs, jobs, ncpus, results);
+    fflush(stdout);
+    while (run < grid->runs || running > 0)
+    {
+        // start runs while there are slots, then wait for one to finish
+        for (slot = 0; slot < jobs && run < grid->runs; slot++)
+        {
+            if (slots[slot].pid != 0)
+            {
+                continue;
+            }
+            snprintf(logpath, sizeof(logpath), "%s.%ld", logname, run);
+            snprintf(outpath, sizeof(outpath), "%s.%ld.out", logname, run);
+            snprintf(metricspath, sizeof(metricspath), "%s.%ld.json", logname, run);
+            memcpy(args, base, nbase * sizeof(char *));
+            nargs = sweep_args(grid, args, nbase, slots[slot].options, sizeof(slots[slot].options));
+            args[nargs++] = "-l";
+            args[nargs++] = logpath;
+            args[nargs++] = "-m";
+            args[nargs++] = metricspath;
+            if (recordfile != NULL)
+            {
+                snprintf(recordpath, sizeof(recordpath), "%s.%ld", recordfile, run);
+                args[nargs++] = "-o";
+                args[nargs++] = recordpath;
+            }
+            args[nargs] = NULL;
+            sweep_group(cpus, ncpus, slot, jobs, mask, slots[slot].cpus, sizeof(slots[slot].cpus));
+            slots[slot].run = run;
+            slots[slot].started = now_ns();
+            if ((pid = fork()) == -1)
+            {
+                perror("Sweep fork");
                 exit(1);
             }
-            totalprocs += 1;
-            fprintf(fp, "total procs: %d\n", totalprocs);
-            if(pid == 0)
+            if (pid == 0)
             {
-                if(execvp(argarray[0], argarray) < 0)
+                // OSS signals its whole process group as it exits, so every run gets a session of its own
+                setsid();
+                setenv(SWEEP_ENV, "1", 1);
+                if (sweep_pin(mask) == -1)
+                {
+                    perror("Sweep affinity");
+                }
+                if ((fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+                {
+                    dup2(fd, STDOUT_FILENO);
+                    dup2(fd, STDERR_FILENO);
+                    close(fd);
+                }
+                execv("/proc/self/exe", args);
+                _exit(127);
+            }
+            slots[slot].pid = pid;
+            running++;
+            run++;
+            sweep_next(grid);
+        }
+        // a run's users are reaped by its master, so the rusage of the wait covers all of it
+        if ((pid = wait4(-1, &status, 0, &usage)) == -1)
+        {
+            perror("Sweep wait4");
+            break;
+        }
+        for (slot = 0; slot < jobs && slots[slot].pid != pid; slot++)
+        {
+        }
+        if (slot == jobs)
+        {
+            continue;
+        }
+        snprintf(metricspath, sizeof(metricspath), "%s.%ld.json", logname, slots[slot].run);
+        sweep_result(out, &slots[slot], metricspath, status, &usage);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        slots[slot].pid = 0;
+        running--;
+    }
+    fclose(out);
+    free(slots);
+    printf("Sweep done: %ld runs, %d failed\n", grid->runs, failed);
+    return failed;
+}
+
+
+int main(int argc, char * argv[]) {
+    int i, c, status;
+    int endtime = 20;
+    int pr_count = 0;
+    int totalprocs = 0;
+    char* filename = NULL;
+    pid_t wait = 0;
+    bool timeElapsed = false;
+    int nresources = DEFAULT_RESOURCES;
+    int launchms = DEFAULT_LAUNCH_MS;
+    int detectms = 0;
+    int policy = VICTIM_FEWEST;
+    int grant_policy = GRANT_FIFO;
+    uint64_t nextDetection = 0;
+    long lastChanges = -1;
+    struct detection_stats detection;
+    struct launch_stats launches;
+    bool pooled = false;
+    int receivers = 0;
+    int nshards = 0;
+    int nengine = 0;
+    bool discrete = false;
+    double *zipf_cum = NULL;
+    long long started;
+    long long received = 0;
+    uint64_t seed = 0;
+    bool seeded = false;
+    double skew = 0;
+    int batch = 1;
+    int terminate = DEFAULT_TERMINATE;
+    int simseconds = 2;
+    double cpu;
+    char *recordfile = NULL;
+    char *replayfile = NULL;
+    char *gridspec = NULL;
+    char *results = DEFAULT_SWEEP_RESULTS;
+    char *restorefile = NULL;
+    struct snapshot_file restore;
+    struct snapshot_header restore_header;
+    int snapshotms = DEFAULT_SNAPSHOT_MS;
+    bool endgiven = false;
+    int jobs = 0;
+    struct sweep_grid grid;
+    char **base;
+    int nbase;
+    FILE *trace = NULL;
+    struct replay_header trace_header;
+    int *trace_totals = NULL;
+    struct proc_table *proc_table;
+    int *resource_table;
+    struct msqid_ds queue_info;
+    struct resource_manager rm;
+    uint64_t endclocktime;
+    uint64_t nextTime = 0;
+    uint64_t now;
+    bool launched;
+    bool haveMessage;
+    int sigfd;
+    sigset_t sigmask;
+    struct timespec wallstart;
+
+    trace_init("oss");
+    metrics.path = DEFAULT_METRICS;
+
+    // Process command line arguments
+    if(argc == 1) //if no arguments passed
+    {
+        printf("ERROR: command line options required, please run ./oss -h for usage instructions.\n");
+        return 1;
+    }
+
+    while ((c = getopt(argc, argv, OPTIONS)) != -1)
+    {
+        switch(c)
+        {
+            case 'h': // -h for help
+                printf("Usage: ./oss [-s x] [-n y] [-i ms] [-t z] [-T secs] [-x n] [-r] [-w] [-P n] [-e n | -D] [-d ms [-v policy] [-k n]] [-g order] [-m file] [-S seed] [-z skew] [-b n] [-o trace | -p trace] [-C file [-c ms]] [-R file] [-G grid [-J n]] -l filename\n");
+                printf("-s x: x is the maximum number of concurrent processes (default %d)\n", DEFAULT_PROCS);
+                printf("-n y: y is the number of resource classes (default %d)\n", DEFAULT_RESOURCES);
+                printf("-i ms: launch a new process at most ms simulated milliseconds after the last (default %d)\n",
+                       DEFAULT_LAUNCH_MS);
+                printf("-t z: z is the number of real time seconds you would like the program to run\n");
+                printf("-T secs: run for secs simulated seconds (default 2)\n");
+                printf("-x n: a process terminates with chance n in 1000 after each action (default %d)\n",
+                       DEFAULT_TERMINATE);
+                printf("-l filename: filename is the name you would like the log file to have. This is a required argument\n");
+                printf("-r: pass messages through shared-memory rings instead of the message queue\n");
+                printf("-w: start a pool of user workers up front and launch processes by waking them\n");
+                printf("-P n: run the master as a pipeline, with n threads receiving requests (one with -r, at most "
+                       "%d) and a thread forking and reaping users\n", MAX_RECEIVERS);
+                printf("-e n: run the processes on n threads of the master instead of forking users (at most %d)\n",
+                       MAX_ENGINE_THREADS);
+                printf("-D: run the processes in the master as discrete events, jumping the clock from one to the "
+                       "next\n");
+                printf("-m file: write latency histograms and counters to file as JSON at exit and on SIGUSR2 "
+                       "(default %s)\n", DEFAULT_METRICS);
+                printf("-S seed: seed the workload, the same seed gives every process the same choices\n");
+                printf("-z skew: users pick resources with Zipf exponent skew, favouring the lowest numbered "
+                       "(default 0, uniform)\n");
+                printf("-b n: users request and release up to n resources per message, and more than one "
+                       "instance of each (default 1, at most %d)\n", MAXBATCH);
+                printf("-o trace: record every launch and accepted message to trace\n");
+                printf("-p trace: replay a recorded trace through the master, without user processes\n");
+                printf("-d ms: grant requests optimistically and look for deadlocks every ms simulated milliseconds\n");
+                printf("-v policy: how -d picks deadlock victims: fewest (resources held, default), youngest or lowest (simpid)\n");
+                printf("-g order: the order blocked requests are woken in: fifo (default), srcf (shortest remaining "
+                       "claim first), aging (srcf, with waiting time counting against the claim) or fair (least "
+                       "granted for its claim first)\n");
+                printf("-k n: with -d, split the resource classes into n shards, each granting on a thread of its own "
+                       "(at most %d)\n", MAX_SHARDS);
+                printf("-C file: with -D, snapshot the whole simulation to file every -c ms of wall time (default "
+                       "%d), from a forked copy so the run doesn't stop\n", DEFAULT_SNAPSHOT_MS);
+                printf("-R file: with -D, restore the simulation from a snapshot and carry on to its end, or to -T "
+                       "simulated seconds\n");
+                printf("-G grid: run oss once for every combination of the grid's option values, like \"s=8,16 "
+                       "S=1..4 r=-,on\" (- leaves an option off), with the rest of the options, logging run k to "
+                       "filename.k, recording it to trace.k with -o, and writing one JSON line per run to the -m file (default %s)\n",
+                       DEFAULT_SWEEP_RESULTS);
+                printf("-J n: with -G, run n at a time, each pinned to its own share of the CPUs (default one per "
+                       "CPU)\n");
+                return 0;
+            case 'd': // -d for deadlock detection instead of avoidance
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    detectms = atoi(optarg);
+                    printf("Detecting deadlocks every %d simulated ms\n", detectms);
+                }
+                else
+                {
+                    printf("Error, -d must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'v': // -v for the deadlock victim policy
+                if (strcmp(optarg, "fewest") == 0)
+                {
+                    policy = VICTIM_FEWEST;
+                }
+                else if (strcmp(optarg, "youngest") == 0)
+                {
+                    policy = VICTIM_YOUNGEST;
+                }
+                else if (strcmp(optarg, "lowest") == 0)
+                {
+                    policy = VICTIM_LOWEST;
+                }
+                else
+                {
+                    printf("Error, -v must be one of fewest, youngest or lowest!\n");
+                    return 1;
+                }
+                break;
+            case 'g': // -g for the order blocked requests are woken in
+                for (i = 0; i < (int)(sizeof(grant_names) / sizeof(grant_names[0])); i++)
+                {
+                    if (strcmp(optarg, grant_names[i]) == 0)
+                    {
+                        break;
+                    }
+                }
+                if (i == (int)(sizeof(grant_names) / sizeof(grant_names[0])))
+                {
+                    printf("Error, -g must be one of fifo, srcf, aging or fair!\n");
+                    return 1;
+                }
+                grant_policy = i;
+                printf("Waking blocked requests in %s order\n", grant_names[i]);
+                break;
+            case 'S': // -S for the workload seed
+                if(isdigit(*optarg))
+                {
+                    seed = strtoull(optarg, NULL, 10);
+                    seeded = true;
+                }
+                else
+                {
+                    printf("Error, -S must be followed by a non-negative integer!\n");
+                    return 1;
+                }
+                break;
+            case 'z': // -z for the Zipf skew of resource picks
+                if(isdigit(*optarg) || *optarg == '.')
+                {
+                    skew = atof(optarg);
+                    printf("Users pick resources with Zipf skew %.2f\n", skew);
+                }
+                else
+                {
+                    printf("Error, -z must be followed by a non-negative number!\n");
+                    return 1;
+                }
+                break;
+            case 'x': // -x for the chance of terminating
+                if(isdigit(*optarg) && atoi(optarg) <= 1000)
+                {
+                    terminate = atoi(optarg);
+                    printf("Processes terminate with chance %d in 1000 after each action\n", terminate);
+                }
+                else
+                {
+                    printf("Error, -x must be followed by an integer from 0 to 1000!\n");
+                    return 1;
+                }
+                break;
+            case 'T': // -T for the simulated run length
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    simseconds = atoi(optarg);
+                    endgiven = true;
+                    printf("Running for %d simulated seconds\n", simseconds);
+                }
+                else
+                {
+                    printf("Error, -T must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'b': // -b for the most (resource, count) pairs per message
+                if(isdigit(*optarg) && atoi(optarg) > 0 && atoi(optarg) <= MAXBATCH)
+                {
+                    batch = atoi(optarg);
+                    printf("Users move up to %d resources per message\n", batch);
+                }
+                else
+                {
+                    printf("Error, -b must be followed by an integer from 1 to %d!\n", MAXBATCH);
+                    return 1;
+                }
+                break;
+            case 'o': // -o to record a trace
+                recordfile = optarg;
+                break;
+            case 'p': // -p to replay a trace
+                replayfile = optarg;
+                break;
+            case 'm': // -m for the metrics file
+                metrics.path = results = optarg;
+                break;
+            case 'C': // -C to snapshot a discrete-event run
+                Snapshots.path = optarg;
+                break;
+            case 'c': // -c for the wall time between snapshots
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    snapshotms = atoi(optarg);
+                }
+                else
+                {
+                    printf("Error, -c must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'R': // -R to restore a discrete-event run from a snapshot
+                restorefile = optarg;
+                break;
+            case 'G': // -G for a sweep over a grid of options
+                gridspec = optarg;
+                break;
+            case 'J': // -J for the runs of a sweep going on at once
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    jobs = atoi(optarg);
+                }
+                else
+                {
+                    printf("Error, -J must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'r': // -r for the shared-memory ring transport
+                transport = TRANSPORT_RING;
+                printf("Using the shared-memory ring transport\n");
+                break;
+            case 'w': // -w for the pre-forked worker pool
+                pooled = true;
+                printf("Launching processes from a pool of pre-forked workers\n");
+                break;
+            case 'P': // -P for the threaded pipeline
+                if(isdigit(*optarg) && atoi(optarg) > 0 && atoi(optarg) <= MAX_RECEIVERS)
+                {
+                    receivers = atoi(optarg);
+                    printf("Running the master as a pipeline with %d receiver threads\n", receivers);
+                }
+                else
+                {
+                    printf("Error, -P must be followed by an integer from 1 to %d!\n", MAX_RECEIVERS);
+                    return 1;
+                }
+                break;
+            case 'D': // -D for the discrete-event mode
+                discrete = true;
+                printf("Running the processes as discrete events\n");
+                break;
+            case 'e': // -e for the in-process simulation engine
+                if(isdigit(*optarg) && atoi(optarg) > 0 && atoi(optarg) <= MAX_ENGINE_THREADS)
+                {
+                    nengine = atoi(optarg);
+                    printf("Running the processes on %d engine threads\n", nengine);
+                }
+                else
+                {
+                    printf("Error, -e must be followed by an integer from 1 to %d!\n", MAX_ENGINE_THREADS);
+                    return 1;
+                }
+                break;
+            case 'k': // -k for the sharded resource manager
+                if(isdigit(*optarg) && atoi(optarg) > 0 && atoi(optarg) <= MAX_SHARDS)
+                {
+                    nshards = atoi(optarg);
+                    printf("Splitting the resource manager into %d shards\n", nshards);
+                }
+                else
+                {
+                    printf("Error, -k must be followed by an integer from 1 to %d!\n", MAX_SHARDS);
+                    return 1;
+                }
+                break;
+            case 's': // -s for max number of processes
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    nprocs = atoi(optarg);
+                    printf("Max %d processes\n", nprocs);
+                }
+                else
+                {
+                    printf("Error, -s must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'n': // -n for number of resource classes
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    nresources = atoi(optarg);
+                    printf("%d resource classes\n", nresources);
+                }
+                else
+                {
+                    printf("Error, -n must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'i': // -i for the longest gap between launches
+                if(isdigit(*optarg) && atoi(optarg) > 0)
+                {
+                    launchms = atoi(optarg);
+                    printf("Launching a process at least every %d simulated ms\n", launchms);
+                }
+                else
+                {
+                    printf("Error, -i must be followed by a positive integer!\n");
+                    return 1;
+                }
+                break;
+            case 'l': // -l for filename (required!)
+                filename = optarg;
+                printf("Log file name is: %s\n", filename);
+                break;
+            case 't': // -t for total running time (wall clock time)
+                if(isdigit(*optarg))
+                {
+                    endtime = atoi(optarg);
+                    printf("Max time to run: %d\n", endtime);
+                }
+                else
                 {
-                    printf("Execution failed!\n");
+                    printf("Error, -t must be followed by an integer!\n");
                     return 1;
                 }
-            }
-            //print process creation
-            if(linecount < LINELIMIT)
-            {
-                fprintf(fp, "Master: Creating child process %d at my time %d.%d\n", pid, Clock->sec, Clock->nsec);
-                linecount++;
-            }
-            printf("sem_wait totalprocs == 0\n");
-            sem_wait(sem_for_mutex);
-            printf("inside critical section of totalprocs == 0\n");
-            if (Clock->nsec + 100 > BILLION)
-            {
-                Clock->sec++;
-                Clock->nsec = Clock->nsec + 100 - BILLION;
-            }
-            else
-            {
-                Clock->nsec = Clock->nsec + 100;
-            }
-            sem_post(sem_for_mutex);
-            printf("sem_post totalprocs == 0\n");
-            nextTime = getNextProcTime(Clock);
+                if(endtime <= 0)
+                {
+                    printf("Error: Number of processes must be positive, please run ./oss -h for more information\n");
+                    return 1;
+                }
+                break;
+            default: // anything else, fail
+                printf("Expected format: [-s x] [-n y] [-i ms] [-T secs] [-x n] [-r] [-w] [-P n] [-e n | -D] [-d ms [-v policy] [-k n]] [-g order] [-m file] [-S seed] [-z skew] [-b n] [-o trace | -p trace] [-C file [-c ms]] [-R file] [-G grid [-J n]] -l filename -t z\n");
+                printf("-s for max number of processes, -n for resource classes, -i for the launch interval, -T for simulated seconds, -x for the termination chance, -l for log file name, -r for the ring transport, -w for the worker pool, -P for the pipeline, -e for the engine, -D for discrete events, -m for the metrics file, -S for the seed, -z for the resource skew, -b for the batch size, -o and -p to record and replay, -d and -v for deadlock detection, -g for the grant order, -k for shards, -C, -c and -R for snapshots, -G and -J for a sweep, and -t for number of seconds to run.\n");
+                return 1;
+        }
+    }
+
+    if(!filename) //ensure filename was passed
+    {
+        printf("Error! Must specify a filename with the -l flag, please run ./oss -h for more info.\n");
+        return(1);
+    }
+
+    // a replay takes its dimensions, deadlock handling and seed from the trace
+    if (replayfile != NULL)
+    {
+        if (recordfile != NULL)
+        {
+            printf("Error, -o and -p can't be used together!\n");
+            return 1;
         }
-        if (hasTimePassed(Clock, nextTime) && (totalprocs < 18))
+        if ((trace = replay_open(replayfile, &trace_header, &trace_totals)) == NULL)
         {
-            printf("Time to launch a new process\n");
-            if ((simpid = getSimpid(procarray)) == -1)
-            {
-                printf("getSimPid returned error\n");
-                exit(1);
-            }
-            printf("Made it through getSimpid\n");
-            procarray[simpid] = 1;
-            printf("after setting procarray\n");
-            sprintf(strsimpid, "%i", simpid);
-            printf("after setting strsimpid\n");
-            for (i = 0; i < 20; i++)
-            {
-                proc_max_resources[simpid][i] = rand() % MAXCLAIM;
-            }
+            printf("Error, %s is not a trace this build can replay!\n", replayfile);
+            return 1;
+        }
+        nprocs = trace_header.nprocs;
+        nresources = trace_header.nresources;
+        detectms = trace_header.detectms;
+        policy = trace_header.policy;
+        grant_policy = trace_header.grant_policy;
+        seed = trace_header.seed;
+        seeded = true;
+        replaying = true;
+        printf("Replaying %s: %d processes, %d resource classes\n", replayfile, nprocs, nresources);
+    }
+    // only a discrete-event run has every process's state in the master, to snapshot and restore. A restored run
+    // takes its dimensions, workload, settings and seed from the snapshot.
+    if ((Snapshots.path != NULL || restorefile != NULL) && !discrete)
+    {
+        printf("Error, -C and -R need -D!\n");
+        return 1;
+    }
+    if (restorefile != NULL)
+    {
+        if (recordfile != NULL || replayfile != NULL)
+        {
+            printf("Error, -R can't be used with -o or -p!\n");
+            return 1;
+        }
+        if (snapshot_open(&restore, restorefile, &restore_header) == -1 || restore_header.nprocs <= 0 ||
+            restore_header.nresources <= 0)
+        {
+            printf("Error, %s is not a snapshot this build can restore!\n", restorefile);
+            return 1;
+        }
+        nprocs = restore_header.nprocs;
+        nresources = restore_header.nresources;
+        seed = restore_header.seed;
+        seeded = true;
+        skew = restore_header.skew;
+        batch = restore_header.batch;
+        terminate = restore_header.terminate;
+        launchms = restore_header.launchms;
+        detectms = restore_header.detectms;
+        policy = restore_header.policy;
+        grant_policy = restore_header.grant_policy;
+        printf("Restoring %s: %d processes, %d resource classes, at %.3f simulated seconds\n", restorefile, nprocs,
+               nresources, restore_header.clock / 1e9);
+    }
+    // the Banker's safety check needs every resource class at once, and the shards' threads interleave
+    // differently every run, so there would be nothing to replay
+    if (nshards > 0)
+    {
+        if (detectms == 0 || recordfile != NULL || replayfile != NULL)
+        {
+            printf("Error, -k needs -d and can't be used with -o or -p!\n");
+            return 1;
+        }
+        if (nshards > nresources)
+        {
+            printf("Error, -k can't make more shards than there are resource classes!\n");
+            return 1;
+        }
+    }
+    // the engine's processes reach the master through its own queues, with no transport, pool or receivers
+    // to choose. The shards' threads reply straight to the users, which the engine's queues can't take.
+    if (nengine > 0 && (transport == TRANSPORT_RING || pooled || receivers > 0 || nshards > 0 || replayfile != NULL))
+    {
+        printf("Error, -e can't be used with -r, -w, -P, -k or -p!\n");
+        return 1;
+    }
+    // the same goes for discrete events, which the master loop steps itself with no threads at all
+    if (discrete && (nengine > 0 || transport == TRANSPORT_RING || pooled || receivers > 0 || nshards > 0 ||
+                     replayfile != NULL))
+    {
+        printf("Error, -D can't be used with -e, -r, -w, -P, -k or -p!\n");
+        return 1;
+    }
+    // a sweep passes every option but its own, and the files each run needs its own of, on to its runs
+    if (gridspec != NULL)
+    {
+        if (Snapshots.path != NULL)
+        {
+            printf("Error, -G can't be used with -C, its runs would write the same snapshot!\n");
+            return 1;
+        }
+        if (replayfile != NULL)
+        {
+            printf("Error, -G can't be used with -p, a replay takes its options from the trace!\n");
+            return 1;
+        }
+        // a run started by a sweep has its -G dropped, so this is only someone setting it by hand
+        if (getenv(SWEEP_ENV) != NULL)
+        {
+            printf("Error, -G can't be used in a run of a sweep!\n");
+            return 1;
+        }
+        if (sweep_parse(&grid, gridspec, OPTIONS, SWEEP_RESERVED) == -1 ||
+            (base = sweep_base(&grid, argc, argv, OPTIONS, SWEEP_RESERVED, &nbase)) == NULL)
+        {
+            return 1;
+        }
+        i = run_sweep(&grid, base, nbase, jobs, filename, recordfile, results);
+        sweep_free(&grid);
+        free(base);
+        return i > 0;
+    }
+    if (!seeded)
+    {
+        seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    printf("Seed: %llu\n", (unsigned long long)seed);
+    prng_init(&rng, seed, 0);
+    metrics.seed = seed;
 
-            char * argarray[] = {"./user", strsimpid, NULL};
-            if ((pid = fork()) < 0)
-            {
-                perror("Fork failed!");
-                exit(1);
-            }
+
+    // Set the timer-kill
+    if (setinterrupt() == -1)
+    {
+        perror("Failed to set up handler");
+        return 1;
+    }
+    if (setperiodic((long) endtime) == -1)
+    {
+        perror("Failed to set up timer");
+        return 1;
+    }
+
+    endclocktime = joinClock(simseconds, 0);
+    if (restorefile != NULL && !endgiven)
+    {
+        endclocktime = restore_header.end;
+    }
+    if (Snapshots.path != NULL)
+    {
+        Snapshots.interval_ns = (long long)snapshotms * MILLISEC;
+        Snapshots.stats = mmap(NULL, sizeof(struct snapshot_stats), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (Snapshots.stats == MAP_FAILED)
+        {
+            perror("Master mmap snapshot stats");
+            exit(1);
+        }
+        memset(Snapshots.stats, 0, sizeof(struct snapshot_stats));
+    }
+
+    // one region holds everything shared with users. The engine and -D have none, but run on it all the same
+    if (region_create(&Region, nprocs, nresources, transport == TRANSPORT_RING, pooled) == -1)
+    {
+        perror("Master region");
+        exit(1);
+    }
+    Clock = Region.clock;
+    Ctl = Region.ctl;
+    proc_table = Region.table;
+    Rings = Region.rings;
+    Pool = Region.pool;
+    proc_table_init(proc_table, nprocs, nresources, seed, skew, batch, terminate);
+
+    resource_table = malloc(nresources * sizeof(int));
+    procarray = calloc(nprocs + 1, sizeof(int));
+    workers = calloc(nprocs + 1, sizeof(pid_t));
+    memset(&launches, 0, sizeof(launches));
+    launches.launched_at = calloc(nprocs + 1, sizeof(long long));
+    if (resource_table == NULL || procarray == NULL || workers == NULL || launches.launched_at == NULL)
+    {
+        perror("Master malloc");
+        exit(1);
+    }
+    for (i = 0; i < nresources; i++)
+    {
+        resource_table[i] = replaying ? trace_totals[i] : (int)prng_below(&rng, 10) + 1;
+    }
+    if (recordfile != NULL)
+    {
+        memset(&trace_header, 0, sizeof(trace_header));
+        trace_header.seed = seed;
+        trace_header.nprocs = nprocs;
+        trace_header.nresources = nresources;
+        trace_header.detectms = detectms;
+        trace_header.policy = policy;
+        trace_header.grant_policy = grant_policy;
+        if ((recording = replay_create(recordfile, &trace_header, resource_table)) == NULL)
+        {
+            perror("Master replay_create");
+            exit(1);
+        }
+    }
+
+    if (rm_init(&rm, nprocs, nresources, resource_table, proc_table->claims) == -1)
+    {
+        perror("Master rm_init");
+        exit(1);
+    }
+    if (slot_init(&slots, nprocs) == -1)
+    {
+        perror("Master slot_init");
+        exit(1);
+    }
+    rm.detection = detectms > 0;
+    rm.grant_policy = grant_policy;
+    metrics.grant_policy = grant_policy;
+    memset(&detection, 0, sizeof(detection));
+    metrics.requested_at = calloc(nprocs + 1, sizeof(long long));
+    metrics.simpid_sim = malloc((nprocs + 1) * sizeof(struct histogram));
+    metrics.simpid_wall = malloc((nprocs + 1) * sizeof(struct histogram));
+    metrics.blocked = malloc(nresources * sizeof(struct histogram));
+    if (metrics.requested_at == NULL || metrics.simpid_sim == NULL || metrics.simpid_wall == NULL ||
+        metrics.blocked == NULL)
+    {
+        perror("Master malloc metrics");
+        exit(1);
+    }
+    hist_init(&metrics.wait_sim);
+    hist_init(&metrics.unblocked);
+    hist_init(&metrics.wait_wall);
+    for (i = 0; i <= nprocs; i++)
+    {
+        hist_init(&metrics.simpid_sim[i]);
+        hist_init(&metrics.simpid_wall[i]);
+    }
+    for (i = 0; i < nresources; i++)
+    {
+        hist_init(&metrics.blocked[i]);
+    }
+    nextDetection = (uint64_t)detectms * MILLISEC;
+    metrics.rm = &rm;
+    metrics.detection = &detection;
+    metrics.launches = &launches;
+
+    // initialize the clock
+    *Clock = 0;
+
+    // Create the message queue. It is private to this run, users find it in the region's header
+    if (nengine == 0 && !discrete)
+    {
+        if ((MsgID = msgget(IPC_PRIVATE, 0600 | IPC_CREAT)) == -1)
+        {
+            perror("Master msgget");
+            exit(1);
+        }
+        Region.header->msgid = MsgID;
+    }
+    region_seal(&Region);
+    // every user can have a request and a reply in the queue at once. If it can't hold them all, senders block
+    // and the master can block sending a reply while the requests it would drain pile up behind it
+    if (nengine == 0 && !discrete && transport == TRANSPORT_QUEUE && msgctl(MsgID, IPC_STAT, &queue_info) == 0 &&
+        queue_info.msg_qbytes < 2 * (nprocs + 1) * MSGSIZE)
+    {
+        queue_info.msg_qbytes = 2 * (nprocs + 1) * MSGSIZE;
+        if (msgctl(MsgID, IPC_SET, &queue_info) == -1)
+        {
+            printf("Warning: the message queue is too small for %d processes, consider -r\n", nprocs);
+        }
+    }
+
+    // Set up the control block users ring to wake us up, and take SIGCHLD through a signalfd so child exits
+    // wake the master out of poll instead of interrupting it
+    Ctl->sleeping = 0;
+    Ctl->nextfork = *Clock;
+    if ((Ctl->doorbell = eventfd(0, EFD_NONBLOCK)) == -1)
+    {
+        perror("Master eventfd");
+        exit(1);
+    }
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigmask, NULL);
+    if ((sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+    {
+        perror("Master signalfd");
+        exit(1);
+    }
+    // every IPC object exists now, so the pool workers can attach to all of them and park
+    if (pooled && !replaying)
+    {
+        started = now_ns();
+        for (i = 1; i <= nprocs; i++)
+        {
+            workers[i] = spawn_user(i, slots.generation[i]);
+        }
+        printf("Started %d pool workers in %.1f ms\n", nprocs, (now_ns() - started) / 1e6);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wallstart);
+    metrics.started = now_ns();
+    metrics.started_cpu = cpu_seconds();
+
+    // open the log, its writer thread does all the file I/O from here on
+    if (event_log_open(&eventlog, filename) == -1)
+    {
+        perror("Master event_log_open");
+        exit(1);
+    }
+    // from here on the spawner thread owns SIGCHLD, and the master loop reaps nothing itself
+    if (receivers > 0 && !replaying)
+    {
+        if (pipeline_start(receivers, sigfd) == NULL)
+        {
+            perror("Master pipeline_start");
+            exit(1);
+        }
+        sigfd = -1;
+    }
+    if (nshards > 0 && sharding_start(nshards, nresources, resource_table, grant_policy) == NULL)
+    {
+        perror("Master sharding_start");
+        exit(1);
+    }
+    if (nengine > 0)
+    {
+        zipf_cum = zipf_table(skew, nresources);
+        if (engine_start(nengine, proc_table, zipf_cum) == NULL)
+        {
+            perror("Master engine_start");
+            exit(1);
+        }
+    }
+    if (discrete)
+    {
+        zipf_cum = zipf_table(skew, nresources);
+        if (discrete_start(proc_table, zipf_cum) == NULL)
+        {
+            perror("Master discrete_start");
+            exit(1);
+        }
+        if (restorefile != NULL)
+        {
+            started = now_ns();
+            snapshot_load(&restore, &restore_header, Discrete, &rm, resource_table, &detection);
+            printf("Restored %s in %.3f ms\n", restorefile, (now_ns() - started) / 1e6);
+        }
+        run_discrete(Discrete, &rm, proc_table, launchms, detectms, policy, endclocktime, &detection, &launches,
+                     restorefile != NULL ? &restore_header : NULL);
+    }
+
+
+    if (replaying)
+    {
+        printf("Replayed %ld records\n", replay_trace(trace, &rm, proc_table, policy, &detection, &launches));
+    }
+
+    // loop until the simulated run length has passed, sleeping whenever there is nothing to do
+    now = readClock(Clock);
+    while(!replaying && Discrete == NULL && now < endclocktime && !stop_requested)
+    {
+        launched = false;
+        if (dump_requested)
+        {
+            dump_requested = 0;
+            dump_metrics(&metrics);
+        }
+        // there may be no simpid free even below the limit, while killed victims are waiting to be reaped
+        if ((totalprocs == 0 || (now >= nextTime && (totalprocs < nprocs))) &&
+            start_process(&rm, proc_table, &launches, now) != -1)
+        {
             totalprocs += 1;
-            if(pid == 0)
-            {
-                if(execvp(argarray[0], argarray) < 0)
-                {
-                    printf("Execution failed!\n");
-                    return 1;
-                }
-            }
-            //print process creation
-            if(linecount < LINELIMIT)
-            {
-                printf("Linecount < LINELIMIT, about to enter critical section\n");
-                sem_wait(sem_for_mutex);
-                printf("in critical section of linecount < LINELIMIT\n");
-                fprintf(fp, "Master: Creating child process %d at my time %d.%d\n", pid, Clock->sec, Clock->nsec);
-                printf("About to leave critical section of linecount < LINELIMIT\n");
-                sem_post(sem_for_mutex);
-                linecount++;
-            }
-            printf("About to enter critical section to increment clock for new time-based proc\n");
-            sem_wait(sem_for_mutex);
-            if (Clock->nsec + 100 > BILLION)
-            {
-                Clock->sec++;
-                Clock->nsec = Clock->nsec + 100 - BILLION;
-            }
-            printf("leaving critical section for new time-based proc\n");
-            sem_post(sem_for_mutex);
-            nextTime = getNextProcTime(Clock);
-            printf("The next clock time to fork a process is %d:%d", nextTime.sec, nextTime.nsec);
-        }
-        msgerror = msgrcv(MsgID, &message, sizeof(message), 0, IPC_NOWAIT);
-        if (msgerror != -1)
-        {
-            printf("message received from process %li: ", message.mtype);
-            printf(message.mtext);
-            printf("\n");
-            // process message
-            strcpy(messageString, message.mtext);
-            temp = strtok(messageString, " ");
-            pid = atoi(temp);
-            temp = strtok(NULL, " ");
-            info = atoi(temp);
-            if (info == TERMINATE)
+            now = advanceClock(Clock, 100);
+            nextTime = getNextProcTime(now, launchms);
+            Ctl->nextfork = nextTime;
+            launched = true;
+        }
+        // in detection mode, look for deadlocks on schedule, or right away if every process is blocked:
+        // then nobody can move the clock, so the scheduled pass would never come. That pass is only worth
+        // running again once a process has blocked or terminated since the last one.
+        if (Shards != NULL)
+        {
+            shard_collect(Shards);
+        }
+        if (rm.detection && (now >= nextDetection ||
+                             (totalprocs > 0 && rm.block_events + metrics.terminations != lastChanges &&
+                              (Shards != NULL ? __atomic_load_n(&Shards->nblocked, __ATOMIC_RELAXED)
+                                              : bit_count(rm.blocked, rm.procwords)) == totalprocs)))
+        {
+            if (recording != NULL)
             {
-                if(linecount < LINELIMIT)
-                {
-                    fprintf(fp, "Process %d with simpid %ld is terminating.\n", pid, message.mtype);
-                    linecount++;
-                }
-                procarray[message.mtype] = 0;
-                totalprocs -= 1;
-                fprintf(fp, "Totalprocs %d\n", totalprocs);
-                msgsnd(MsgID, &message, sizeof(message), 0);
-                waitpid(pid, &status, 0);
+                replay_write(recording, REPLAY_DETECT, 0, now, readClock(Clock), NULL, NULL, 0);
             }
-            else
+            totalprocs -= detection_pass(&rm, policy, now, &detection);
+            lastChanges = rm.block_events + metrics.terminations;
+            nextDetection = now + (uint64_t)detectms * MILLISEC;
+        }
+        if (Pipeline != NULL)
+        {
+            pipeline_collect(Pipeline);
+        }
+        haveMessage = receive_message(&message, &received);
+        if (!haveMessage && !launched)
+        {
+            haveMessage = wait_for_work(&message, &received, sigfd);
+        }
+        // anything from a process that has since been killed, or from before its simpid was reused, is dropped
+        if (haveMessage && !slot_current(&slots, message.simpid, message.generation))
+        {
+            log_event(EV_STALE, now, message.pid, message.simpid, 0, message.generation);
+            metrics.stale++;
+            haveMessage = false;
+        }
+        // a request can beat the spawner's report of the pid of the process that sent it
+        if (haveMessage && Pipeline != NULL && procarray[message.simpid] == 0)
+        {
+            pipeline_await_spawn(Pipeline, message.simpid);
+        }
+        // an interrupt ends the run where it is, anything that came in with it is dropped
+        if (stop_requested)
+        {
+            break;
+        }
+        if (haveMessage && launches.launched_at[message.simpid] != 0)
+        {
+            launches.first_request_ns += now_ns() - launches.launched_at[message.simpid];
+            launches.first_requests++;
+            launches.launched_at[message.simpid] = 0;
+        }
+        if (haveMessage)
+        {
+            if (recording != NULL)
             {
-                temp = strtok(NULL, " ");
-                resource = atoi(temp);
-                if(linecount < LINELIMIT) {
-                    if (info == REQUEST) {
-                        fprintf(fp, "Process %d with simpid %ld is requesting resource %d\n", pid, message.mtype,
-                                resource);
-                        linecount++;
-                    } else {
-                        fprintf(fp, "Process %d with simpid %ld is releasing resource %d\n", pid, message.mtype,
-                                resource);
-                        linecount++;
-                    }
-                }
-                msgsnd(MsgID, &message, sizeof(message), 0);
+                replay_write(recording, REPLAY_MESSAGE, message.simpid, now, readClock(Clock), &message, NULL, 0);
             }
+            handle_message(&rm, &message, now, received, &totalprocs, sigfd);
         }
+        now = readClock(Clock);
     }
 //        // process the message
 //        strcpy(messageString, message.mtext);
@@ -533,18 +3410,101 @@ int main(int argc, char * argv[]) {
 //
 //        waitpid(pid, &status, 0);
 
-    // we're done, detach and free shared memory and close the file
+    if (Pipeline != NULL)
+    {
+        pipeline_stop(Pipeline);
+    }
+    if (Engine != NULL)
+    {
+        i = Engine->serial;
+        printf("Engine: %d threads ran %d processes in %ld steps\n", nengine, i, engine_stop(Engine));
+        free(zipf_cum);
+    }
+    if (Discrete != NULL)
+    {
+        printf("Discrete events: %ld events handled, %d processes took %ld steps\n", Discrete->handled,
+               Discrete->serial, Discrete->steps);
+        if (Snapshots.path != NULL)
+        {
+            report_snapshots(Snapshots.stats);
+            munmap(Snapshots.stats, sizeof(struct snapshot_stats));
+            free(Snapshots.table);
+        }
+        discrete_stop(Discrete);
+        free(zipf_cum);
+    }
+    if (Shards != NULL)
+    {
+        printf("Shards: %d, %ld of the %ld requests and releases routed to them spanned more than one\n",
+               nshards, Shards->spanning, Shards->routed);
+        sharding_stop(Shards);
+    }
+    if (event_log_close(&eventlog) == -1)
+    {
+        printf("Warning: the event log could not be written in full\n");
+    }
+    printf("Event log: %u events in %ld writes, the master waited on a full log %ld times\n", eventlog.head,
+           eventlog.batches, eventlog.stalls);
+    cpu = report_cpu_usage(&wallstart);
+    report_throughput(&rm, &wallstart);
+    report_sim_rate(&wallstart);
+    report_units(&metrics, cpu);
+    if (!replaying)
+    {
+        report_launches(&launches);
+    }
+    dump_metrics(&metrics);
+    printf("Metrics written to %s\n", metrics.path);
+    metrics.rm = NULL;
+    printf("Blocked waits, %s order: %llu requests, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f simulated us\n",
+           grant_names[grant_policy], (unsigned long long)metrics.unblocked.count,
+           hist_quantile(&metrics.unblocked, 0.5) / 1e3, hist_quantile(&metrics.unblocked, 0.99) / 1e3,
+           hist_quantile(&metrics.unblocked, 0.999) / 1e3, metrics.unblocked.max / 1e3);
+    if (rm.detection)
+    {
+        printf("Detection: %ld passes, %ld deadlocks, %ld victims killed, %.0f ns per pass on average\n",
+               detection.passes, detection.deadlocks, detection.victims,
+               detection.passes ? (double)detection.total_ns / detection.passes : 0.0);
+    }
+    else
+    {
+        printf("Safety checks: %ld kept the cached safe sequence, %ld needed the full check\n", rm.fast_checks,
+               rm.full_checks);
+    }
+
+    // we're done, unmap the region and close the file
     // then send a kill signal to the children and wait for them to exit
-    shmdt(Clock);
-    shmdt(proc_max_resources);
-    shmctl(ClockID, IPC_RMID, NULL);
-    shmctl(ProcTableID, IPC_RMID, NULL);
-    msgctl(MsgID, IPC_RMID, NULL);
-    fclose(fp);
-    sem_close(sem_for_mutex);
-    sem_unlink(SEM_NAME);
-    signal(SIGUSR1, SIG_IGN);
-    kill(-1*getpid(), SIGUSR1);
+    region_close(&Region);
+    rm_free(&rm);
+    slot_destroy(&slots);
+    free(resource_table);
+    free(procarray);
+    free(workers);
+    free(launches.launched_at);
+    free(metrics.requested_at);
+    free(metrics.simpid_sim);
+    free(metrics.simpid_wall);
+    free(metrics.blocked);
+    if (recording != NULL)
+    {
+        fclose(recording);
+    }
+    if (trace != NULL)
+    {
+        fclose(trace);
+        free(trace_totals);
+    }
+    close(sigfd);
+    if (MsgID != -1)
+    {
+        msgctl(MsgID, IPC_RMID, NULL);
+    }
+    // a replay has no children to stop
+    if (!replaying)
+    {
+        signal(SIGUSR1, SIG_IGN);
+        kill(-1*getpid(), SIGUSR1);
+    }
     while(pr_count > 0)
     {
         wait = waitpid(-1, &status, WNOHANG);
@@ -553,6 +3513,11 @@ int main(int argc, char * argv[]) {
             pr_count--;
         }
     }
+    if (stop_requested)
+    {
+        printf("Exiting early on an interrupt\n");
+        return 1;
+    }
     printf("Exiting normally\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The plumbing of OSS's threaded pipeline (-P). The master loop keeps the resource manager and every decision
+ * that touches it, receiver threads take requests off the transport, and a spawner thread forks users and
+ * reaps them, so neither a msgrcv nor a fork ever holds up a grant. The threads hand work to each other
+ * through bounded single-producer/single-consumer queues of fixed-size records, with no locks, and ring the
+ * bell of whoever they made work for.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "message.h"
+
+struct spsc_queue {
+    unsigned int head;                              // next record to write, only advanced by the producer
+    char pad_head[CACHELINE - sizeof(unsigned int)];
+    unsigned int tail;                              // next record to read, only advanced by the consumer
+    char pad_tail[CACHELINE - sizeof(unsigned int)];
+    unsigned int capacity;                          // records, a power of two
+    size_t size;                                    // bytes per record
+    char *records;
+};
+
+// A thread's wakeup: whoever gives it work rings it, and only the first ring after it goes to sleep pays for
+// the write, the same protocol as the master's doorbell in message.h
+struct bell {
+    int sleeping;                                   // nonzero while the owner is blocked on fd
+    int fd;                                         // an eventfd
+};
+
+
+// Sets up an empty queue of at least capacity records of size bytes. Returns 0, or -1 if it can't be allocated.
+static inline int spsc_init(struct spsc_queue *q, unsigned int capacity, size_t size)
+{
+    memset(q, 0, sizeof(*q));
+    q->capacity = 1;
+    while (q->capacity < capacity)
+    {
+        q->capacity <<= 1;
+    }
+    q->size = size;
+    if (posix_memalign((void **)&q->records, CACHELINE, (size_t)q->capacity * size) != 0)
+    {
+        q->records = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline void spsc_free(struct spsc_queue *q)
+{
+    free(q->records);
+    q->records = NULL;
+}
+
+
+// Producer side: appends a copy of record, returns 0 if the queue was full
+static inline int spsc_push(struct spsc_queue *q, const void *record)
+{
+    unsigned int head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->capacity)
+    {
+        return 0;
+    }
+    memcpy(q->records + (size_t)(head & (q->capacity - 1)) * q->size, record, q->size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+// Consumer side: copies out and removes the oldest record, returns 0 if the queue was empty
+static inline int spsc_pop(struct spsc_queue *q, void *record)
+{
+    unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail)
+    {
+        return 0;
+    }
+    memcpy(record, q->records + (size_t)(tail & (q->capacity - 1)) * q->size, q->size);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+static inline int spsc_empty(struct spsc_queue *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
+
+
+// Wakes the bell's owner if it is asleep
+static inline void bell_ring(struct bell *b)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&b->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        write(b->fd, &one, sizeof(one));
+    }
+}
+
+
+// Owner side: announces that it is about to sleep. Check for work once more after this and before polling
+// fd, or a ring that came in between is lost until the timeout.
+static inline void bell_arm(struct bell *b)
+{
+    __atomic_store_n(&b->sleeping, 1, __ATOMIC_SEQ_CST);
+}
+
+
+// Owner side: after waking, clears the flag and drains the eventfd
+static inline void bell_clear(struct bell *b)
+{
+    uint64_t count;
+
+    __atomic_store_n(&b->sleeping, 0, __ATOMIC_SEQ_CST);
+    read(b->fd, &count, sizeof(count));
+}
+
+#endif
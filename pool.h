@@ -0,0 +1,51 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The pre-forked worker pool used when OSS is run with -w. Every simpid gets one user process at startup that
+ * attaches to the clock, the process table and its transport once and then parks on its pool slot. Launching a
+ * process for the simpid is then just posting a new generation to the slot and waking the worker through a
+ * futex on seq; when the process terminates the worker parks again instead of exiting.
+ * The slots live at the end of the region OSS shares with its users (region.h).
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <limits.h>
+#include "message.h"
+#include "ring.h"
+
+#define POOL_ARG "pool"         // passed as the generation argument to start a user as a pool worker
+
+struct pool_slot {
+    unsigned int seq;           // futex word, bumped by the master for every launch
+    unsigned int generation;    // the generation the worker runs its next process under
+    char pad[CACHELINE - 2 * sizeof(unsigned int)];
+} __attribute__((aligned(CACHELINE)));
+
+
+// Master side: starts a new process in the worker parked on slot
+static inline void pool_launch(struct pool_slot *slot, unsigned int generation)
+{
+    slot->generation = generation;
+    __atomic_add_fetch(&slot->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&slot->seq, INT_MAX);
+}
+
+
+// Worker side: blocks until the master launches a process after sequence number seen, then copies out its
+// generation. Returns the new sequence number, which the caller passes back in once the process terminates.
+static inline unsigned int pool_await(struct pool_slot *slot, unsigned int seen, unsigned int *generation)
+{
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) == seen)
+    {
+        futex_wait(&slot->seq, seen);
+    }
+    *generation = slot->generation;
+    return seq;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The workload's random numbers: xoshiro256** streams seeded through splitmix64. OSS draws from stream 0 of
+ * the run's seed; every process a user runs draws from its own stream, numbered from its simpid and
+ * generation, so the same seed gives every process the same choices no matter how the processes interleave.
+ * prng_below replaces rand() % n without its bias.
+ */
+
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stdint.h>
+
+struct prng {
+    uint64_t s[4];
+};
+
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+// Starts stream number stream of seed
+static inline void prng_init(struct prng *rng, uint64_t seed, uint64_t stream)
+{
+    uint64_t x = seed ^ splitmix64(&stream);
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        rng->s[i] = splitmix64(&x);
+    }
+}
+
+
+// The stream a user process draws from
+static inline uint64_t prng_stream(int simpid, unsigned int generation)
+{
+    return ((uint64_t)simpid << 32) | generation;
+}
+
+
+static inline uint64_t prng_next(struct prng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = s[1] * 5;
+    uint64_t t = s[1] << 17;
+
+    result = ((result << 7) | (result >> 57)) * 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+
+// A uniform number from 0 to n - 1, by Lemire's multiply-and-reject: one multiply, and a retry only for the
+// rare draws that would make some results more likely than others
+static inline uint64_t prng_below(struct prng *rng, uint64_t n)
+{
+    unsigned __int128 m = (unsigned __int128)prng_next(rng) * n;
+    uint64_t low = (uint64_t)m;
+    uint64_t threshold;
+
+    if (low < n)
+    {
+        threshold = -n % n;
+        while (low < threshold)
+        {
+            m = (unsigned __int128)prng_next(rng) * n;
+            low = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+}
+
+
+// A double uniform in [0, 1)
+static inline double prng_double(struct prng *rng)
+{
+    return (prng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The process table OSS shares with every User: each simpid's maximum claim on each resource class.
+ * How many simpids and resource classes there are is decided when OSS starts, so the table begins with a
+ * header giving its dimensions and the run's workload, and users size everything from that. The claims
+ * follow as one contiguous array of rows, one per simpid, each padded out to whole cache lines so that
+ * writing one simpid's row never touches a line holding another's.
+ */
+
+#ifndef PROCTABLE_H
+#define PROCTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+
+
+// Rounds a size in bytes up to a whole number of cache lines
+#define CACHE_ROUND(bytes) (((bytes) + CACHELINE - 1) / CACHELINE * CACHELINE)
+// The number of ints in a row of nresources ints padded to whole cache lines
+#define ROW_STRIDE(nresources) ((int)(CACHE_ROUND((nresources) * sizeof(int)) / sizeof(int)))
+
+struct proc_table {
+    uint64_t seed;              // the run's seed, every user process draws from its own stream of it
+    double skew;                // Zipf exponent users pick resources with, 0 for uniform
+    int batch;                  // the most resources a user moves per message, 1 for one instance at a time
+    int terminate;              // the chance in 1000 that a process terminates after each thing it does
+    int nprocs;                 // simpids run from 1 to nprocs, row 0 is unused
+    int nresources;             // resource classes, the used part of every row
+    int stride;                 // ints from one row to the next
+    char pad[CACHELINE - sizeof(uint64_t) - sizeof(double) - 5 * sizeof(int)];
+    int claims[];               // nprocs + 1 rows of stride ints
+} __attribute__((aligned(CACHELINE)));
+
+
+// The size of the table for the given dimensions
+static inline size_t proc_table_size(int nprocs, int nresources)
+{
+    return sizeof(struct proc_table) + (size_t)(nprocs + 1) * ROW_STRIDE(nresources) * sizeof(int);
+}
+
+
+// Fills in the header of a freshly created table and zeroes every claim
+static inline void proc_table_init(struct proc_table *table, int nprocs, int nresources, uint64_t seed,
+                                   double skew, int batch, int terminate)
+{
+    table->seed = seed;
+    table->skew = skew;
+    table->batch = batch;
+    table->terminate = terminate;
+    table->nprocs = nprocs;
+    table->nresources = nresources;
+    table->stride = ROW_STRIDE(nresources);
+    memset(table->claims, 0, (size_t)(nprocs + 1) * table->stride * sizeof(int));
+}
+
+
+// The row of maximum claims for simpid
+static inline int *proc_table_row(struct proc_table *table, int simpid)
+{
+    return table->claims + (size_t)simpid * table->stride;
+}
+
+#endif
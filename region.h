@@ -0,0 +1,180 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The one shared-memory region OSS shares with its users: the clock, the control block, the process table and,
+ * with -r and -w, the ring channels and the pool slots, one after another on cache-line boundaries behind a
+ * header. OSS creates it with memfd_create, ftruncate and one mmap, and every user inherits the descriptor
+ * across exec and maps it with one mmap of its own. A memfd has no key or name anyone else can open, so runs
+ * side by side never attach to each other's memory, and it goes away with the last process mapping it: a run
+ * that crashes leaves nothing for the next run to attach to and nothing to clean up with ipcrm.
+ *
+ * The header says what the region holds and where. A user checks the magic, the version, the header's
+ * checksum and that the region belongs to its parent before it trusts any of it.
+ */
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "message.h"
+#include "proctable.h"
+#include "ring.h"
+#include "pool.h"
+
+#define REGION_MAGIC "OSSREGN"
+#define REGION_VERSION 1
+
+struct region_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;          // FNV-1a of the header with this field zero, set last by region_seal
+    uint64_t size;              // bytes in the whole region
+    int32_t owner;              // pid of the master that created it
+    int32_t msgid;              // the master's message queue, -1 if it has none
+    int32_t nprocs;
+    int32_t nresources;
+    uint64_t clock;             // offsets of the parts from the start of the region, 0 for a part it doesn't hold
+    uint64_t ctl;
+    uint64_t table;
+    uint64_t rings;
+    uint64_t pool;
+};
+
+struct region {
+    struct region_header *header;
+    int fd;
+    uint64_t *clock;
+    struct master_ctl *ctl;
+    struct proc_table *table;
+    struct ring_channel *rings;     // NULL without -r
+    struct pool_slot *pool;         // NULL without -w
+};
+
+
+static inline uint32_t region_checksum(const struct region_header *h)
+{
+    struct region_header copy = *h;
+    const unsigned char *p = (const unsigned char *)&copy;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    copy.checksum = 0;
+    for (i = 0; i < sizeof(copy); i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+// Points the region's parts at the offsets its header gives
+static inline void region_parts(struct region *r)
+{
+    char *base = (char *)r->header;
+
+    r->clock = (uint64_t *)(base + r->header->clock);
+    r->ctl = (struct master_ctl *)(base + r->header->ctl);
+    r->table = (struct proc_table *)(base + r->header->table);
+    r->rings = r->header->rings != 0 ? (struct ring_channel *)(base + r->header->rings) : NULL;
+    r->pool = r->header->pool != 0 ? (struct pool_slot *)(base + r->header->pool) : NULL;
+}
+
+
+// Master side: creates a zeroed region for nprocs simpids and nresources resource classes, with ring channels
+// and pool slots if asked for. The descriptor is left open across exec for the users. Returns 0, or -1 with
+// errno set.
+static inline int region_create(struct region *r, int nprocs, int nresources, int rings, int pool)
+{
+    struct region_header h;
+    uint64_t used = CACHE_ROUND(sizeof(struct region_header));
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, REGION_MAGIC, sizeof(h.magic));
+    h.version = REGION_VERSION;
+    h.owner = getpid();
+    h.msgid = -1;
+    h.nprocs = nprocs;
+    h.nresources = nresources;
+    h.clock = used;
+    used += CACHE_ROUND(sizeof(uint64_t));
+    h.ctl = used;
+    used += CACHE_ROUND(sizeof(struct master_ctl));
+    h.table = used;
+    used += CACHE_ROUND(proc_table_size(nprocs, nresources));
+    if (rings)
+    {
+        h.rings = used;
+        used += CACHE_ROUND(sizeof(struct ring_channel) * (nprocs + 1));
+    }
+    if (pool)
+    {
+        h.pool = used;
+        used += CACHE_ROUND(sizeof(struct pool_slot) * (nprocs + 1));
+    }
+    h.size = used;
+
+    // called through syscall like the futexes in ring.h, glibc only declares memfd_create for _GNU_SOURCE
+    if ((r->fd = syscall(SYS_memfd_create, "oss-region", 0)) == -1)
+    {
+        return -1;
+    }
+    // a fresh memfd reads as zeroes, so nothing past the header needs clearing
+    if (ftruncate(r->fd, used) == -1 ||
+        (r->header = mmap(NULL, used, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) == MAP_FAILED)
+    {
+        close(r->fd);
+        return -1;
+    }
+    *r->header = h;
+    region_parts(r);
+    return 0;
+}
+
+
+// Master side: sets the checksum once the header is final. Users started before this refuse the region.
+static inline void region_seal(struct region *r)
+{
+    uint32_t sum = region_checksum(r->header);
+
+    __atomic_store_n(&r->header->checksum, sum, __ATOMIC_RELEASE);
+}
+
+
+// User side: maps the region on the inherited descriptor fd and checks it is a sealed region of this version
+// created by owner. Returns 0, or -1 if it can't be mapped or isn't one.
+static inline int region_attach(struct region *r, int fd, pid_t owner)
+{
+    struct stat st;
+
+    r->fd = fd;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct region_header) ||
+        (r->header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        return -1;
+    }
+    if (memcmp(r->header->magic, REGION_MAGIC, sizeof(r->header->magic)) != 0 ||
+        r->header->version != REGION_VERSION || r->header->size != (uint64_t)st.st_size ||
+        r->header->owner != owner ||
+        __atomic_load_n(&r->header->checksum, __ATOMIC_ACQUIRE) != region_checksum(r->header))
+    {
+        munmap(r->header, st.st_size);
+        return -1;
+    }
+    region_parts(r);
+    return 0;
+}
+
+
+static inline void region_close(struct region *r)
+{
+    munmap(r->header, r->header->size);
+    close(r->fd);
+}
+
+#endif
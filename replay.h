@@ -0,0 +1,140 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Request traces for OSS's record (-o) and replay (-p) modes. A trace holds everything the master decided on,
+ * in the order it did: every launch with the claims it drew, every message it accepted, and every point it
+ * ran a deadlock detection pass. Replaying one feeds the same inputs through the same code with no user
+ * processes, so two builds of the master can be compared on exactly the same run.
+ *
+ * The file is a replay_header and the resource totals, then records. A launch record is followed by the
+ * claims row of the launched simpid, nresources ints.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "message.h"
+
+#define REPLAY_MAGIC "OSSTRACE"
+#define REPLAY_VERSION 4
+#define REPLAY_BUFSIZE (1 << 20)
+
+enum {
+    REPLAY_LAUNCH = 1,          // simpid launched, msg.pid is its pid (0 if not known yet) and msg.generation
+                                // its generation
+    REPLAY_MESSAGE,             // msg accepted from a user
+    REPLAY_DETECT,              // a detection pass ran
+    REPLAY_SPAWNED              // the pid of a launch that had none, msg.pid, came back from the spawner thread
+};
+
+struct replay_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t seed;
+    int nprocs;
+    int nresources;
+    int detectms;               // 0 if the run avoided deadlock instead of detecting it
+    int policy;                 // the victim policy, if detecting
+    int grant_policy;           // the order blocked requests were woken in
+};
+
+struct replay_record {
+    int type;
+    int simpid;
+    uint64_t now;               // the master's clock reading at the top of the loop pass it acted in
+    uint64_t clock;             // the clock when it acted, which the users may have moved on since
+    struct mesg_buf msg;
+};
+
+
+// Creates a trace and writes its header and the resource totals. Returns NULL if the file can't be created.
+static inline FILE *replay_create(const char *filename, struct replay_header *header, const int *totals)
+{
+    FILE *fp = fopen(filename, "wb");
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, REPLAY_BUFSIZE);
+    memcpy(header->magic, REPLAY_MAGIC, sizeof(header->magic));
+    header->version = REPLAY_VERSION;
+    header->record_size = sizeof(struct replay_record);
+    fwrite(header, sizeof(*header), 1, fp);
+    fwrite(totals, sizeof(int), header->nresources, fp);
+    return fp;
+}
+
+
+static inline void replay_write(FILE *fp, int type, int simpid, uint64_t now, uint64_t clock,
+                                const struct mesg_buf *msg, const int *claims, int nresources)
+{
+    struct replay_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.simpid = simpid;
+    rec.now = now;
+    rec.clock = clock;
+    if (msg != NULL)
+    {
+        rec.msg = *msg;
+    }
+    fwrite(&rec, sizeof(rec), 1, fp);
+    if (type == REPLAY_LAUNCH)
+    {
+        fwrite(claims, sizeof(int), nresources, fp);
+    }
+}
+
+
+// Opens a trace and reads its header. *totals is malloced to hold the resource totals.
+// Returns NULL if the file can't be read or isn't a trace this build understands.
+static inline FILE *replay_open(const char *filename, struct replay_header *header, int **totals)
+{
+    FILE *fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, REPLAY_BUFSIZE);
+    if (fread(header, sizeof(*header), 1, fp) != 1 || memcmp(header->magic, REPLAY_MAGIC, sizeof(header->magic))
+        || header->version != REPLAY_VERSION || header->record_size != sizeof(struct replay_record)
+        || header->nprocs <= 0 || header->nresources <= 0 ||
+        (*totals = malloc(header->nresources * sizeof(int))) == NULL)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    if (fread(*totals, sizeof(int), header->nresources, fp) != (size_t)header->nresources)
+    {
+        free(*totals);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+
+// Reads the next record, and for a launch its claims into claims. Returns 0 at the end of the trace.
+static inline int replay_read(FILE *fp, struct replay_record *rec, int *claims, int nresources)
+{
+    if (fread(rec, sizeof(*rec), 1, fp) != 1)
+    {
+        return 0;
+    }
+    if (rec->type == REPLAY_LAUNCH && fread(claims, sizeof(int), nresources, fp) != (size_t)nresources)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+#endif
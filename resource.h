@@ -0,0 +1,810 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The master's resource manager. It owns the resource tables and decides, with the Banker's algorithm, whether a
+ * request can be granted now, has to wait, or can never be granted. A request only waits if granting it
+ * would leave the system unsafe or there are not enough free instances. A request is a batch of (resource,
+ * count) pairs and is granted or blocked as a whole, with one safety check. Blocked requests wait in the queue
+ * for the first resource they asked for, and are retried whenever something is released.
+ *
+ * The order waiters are retried in, and so granted in when several fit, is the grant policy's. Each waiter gets
+ * a key when it blocks, and every queue is a binary min-heap on (key, order of blocking), with each simpid's
+ * place in it kept so a victim is taken out in O(log n). The key never needs updating while the request waits:
+ * a blocked process is granted and releases nothing, and aging is folded into the key (see rm_wait_key).
+ * rm_wake walks all the heaps at once in key order, with a heap of cursors into them, so a grant goes to the
+ * first waiter in the whole system that fits rather than the first in the lowest numbered resource's queue.
+ *
+ * The safety check is incremental. The manager keeps the safe sequence it last found (order), along with the
+ * instances that would be free just before each process in it runs (seqwork). Granting c instances of r to
+ * the process at position k only lowers seqwork[0..k][r] by c, so the sequence is still valid exactly when
+ * every process ahead of k still fits on resource r - an O(k) test on one column, or on one column per pair of
+ * a batch. Releases, terminations and admissions never invalidate the sequence and update it in place. Only
+ * when a grant breaks the cached sequence do we fall back to the full O(n^2 m) search, which either finds a
+ * new sequence or proves the grant unsafe.
+ *
+ * A request that could not be granted stays ungrantable until something is released: further grants and
+ * admissions only leave less to go around. So every release or termination starts a new epoch, and rm_wake
+ * only retries a waiter once per epoch, rather than once per grant it hands out.
+ *
+ * In detection mode the safety check is skipped: any request that fits in what is free is granted, and
+ * deadlocks are found after the fact by rm_detect and broken by terminating victims chosen by rm_choose_victim.
+ *
+ * The number of simpids and resource classes is set by rm_init. Every table lives in one allocation with each
+ * array starting on its own cache line, and the per-process tables use the same padded row stride as the
+ * shared process table (see proctable.h). Whole-row work goes through the kernels in rowops.h, which run over
+ * the padding as well, so every row and per-resource array here is a full stride long and padded with zeroes.
+ */
+
+#ifndef RESOURCE_H
+#define RESOURCE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "message.h"
+#include "bitset.h"
+#include "proctable.h"
+#include "rowops.h"
+
+#define GRANTED 1
+#define BLOCKED 2
+#define DENIED 3
+
+#define VICTIM_FEWEST 0         // the deadlocked process holding the fewest instances
+#define VICTIM_YOUNGEST 1       // the most recently launched deadlocked process
+#define VICTIM_LOWEST 2         // the deadlocked process with the lowest simpid
+
+#define GRANT_FIFO 0            // the oldest request first
+#define GRANT_SRCF 1            // shortest remaining claim first: the process with the fewest instances left to claim
+#define GRANT_AGING 2           // shortest remaining claim, less one instance for every RM_AGING_NS waited
+#define GRANT_FAIR 3            // the process granted the fewest instances so far for the size of its claim
+
+#define RM_AGING_NS 50000000LL  // simulated ns of waiting worth one instance of remaining claim under GRANT_AGING
+#define RM_FAIR_SCALE 1024      // fixed point for the GRANT_FAIR share
+
+// Row i of a per-process table of rm
+#define RM_ROW(rm, table, i) ((table) + (size_t)(i) * (rm)->stride)
+// The set of simpids holding resource r
+#define RM_HOLDERS(rm, r) ((rm)->holders + (size_t)(r) * (rm)->procwords)
+
+struct wait_queue {
+    int *heap;                              // the waiting simpids, a min-heap on (wait_key, wait_seq)
+    int count;
+};
+
+// Where rm_wake is in one queue's heap
+struct wait_cursor {
+    int resource;
+    int index;
+};
+
+struct resource_manager {
+    int nprocs;                             // simpids run from 1 to nprocs, row 0 is unused
+    int nresources;                         // resource classes
+    int stride;                             // ints from one row of a per-process table to the next
+    int procwords;                          // words in a set of simpids
+    int reswords;                           // words in a set of resources
+    int *total;                             // instances of each resource in the system
+    int *available;                         // instances not allocated to anyone
+    int *allocation;                        // instances each simpid holds, one row per simpid
+    int *max;                               // each simpid's maximum claim, the rows of the shared process table
+    int *active;                            // simpids currently running
+    int *order;                             // a safe sequence of the active simpids
+    int *position;                          // where each active simpid is in order
+    int norder;                             // number of simpids in order
+    int *seqwork;                           // instances free just before order[i] runs to completion, one row each
+    struct wait_queue *queues;              // blocked requests, per resource
+    int *queue_slots;                       // the heaps behind queues, one after another
+    long long *wait_key;                    // each blocked simpid's place in the grant order, lowest first
+    long *wait_seq;                         // when it blocked, counted in block_events, to break ties
+    int *heap_pos;                          // its index in its queue's heap
+    long *service;                          // instances granted to each simpid since it was admitted
+    int grant_policy;                       // GRANT_FIFO, GRANT_SRCF, GRANT_AGING or GRANT_FAIR
+    uint64_t *waiting;                      // resources whose queue is not empty
+    struct mesg_buf *pending;               // the request each blocked simpid is waiting on, queued on its
+                                            // first resource
+    uint64_t *blocked;                      // simpids waiting in one of the queues
+    uint64_t *holders;                      // simpids holding at least one instance of each resource
+    long *born;                             // admission order of each simpid, for picking the youngest
+    long *tried;                            // the epoch in which each blocked simpid was last found ungrantable
+    long epoch;                             // bumped whenever instances are handed back
+    long admissions;
+    int detection;                          // grant without the safety check, deadlocks are found by rm_detect
+    long block_events;                      // times a request has had to wait
+    long grants;                            // requests granted, right away or after waiting
+    long fast_checks;                       // grants proven safe by the cached sequence
+    long full_checks;                       // grants that needed the full safety check
+    // scratch space for rm_full_safety_check and rm_detect, so neither has to allocate
+    int *work;
+    int *scratch_order;
+    int *scratch_seqwork;
+    int *finished;
+    int *stack;
+    struct wait_cursor *frontier;           // rm_wake's heap of cursors
+    void *arena;                            // the one allocation every table above is carved from
+};
+
+
+// Lays out the tables of rm in the block at base and returns how many bytes they take.
+// With base NULL nothing is assigned, which is how rm_init finds out how much to allocate.
+static inline size_t rm_layout(struct resource_manager *rm, char *base)
+{
+    size_t rows = rm->nprocs + 1;
+    size_t table = rows * rm->stride * sizeof(int);
+    size_t used = 0;
+
+#define RM_CARVE(field, bytes) do { if (base) rm->field = (void *)(base + used); used += CACHE_ROUND(bytes); } while (0)
+    RM_CARVE(total, rm->nresources * sizeof(int));
+    RM_CARVE(available, rm->nresources * sizeof(int));
+    RM_CARVE(allocation, table);
+    RM_CARVE(active, rows * sizeof(int));
+    RM_CARVE(order, rows * sizeof(int));
+    RM_CARVE(position, rows * sizeof(int));
+    RM_CARVE(seqwork, table);
+    RM_CARVE(queues, rm->nresources * sizeof(struct wait_queue));
+    RM_CARVE(queue_slots, rm->nresources * rows * sizeof(int));
+    RM_CARVE(wait_key, rows * sizeof(long long));
+    RM_CARVE(wait_seq, rows * sizeof(long));
+    RM_CARVE(heap_pos, rows * sizeof(int));
+    RM_CARVE(service, rows * sizeof(long));
+    RM_CARVE(waiting, rm->reswords * sizeof(uint64_t));
+    RM_CARVE(pending, rows * sizeof(struct mesg_buf));
+    RM_CARVE(blocked, rm->procwords * sizeof(uint64_t));
+    RM_CARVE(holders, rm->nresources * rm->procwords * sizeof(uint64_t));
+    RM_CARVE(born, rows * sizeof(long));
+    RM_CARVE(tried, rows * sizeof(long));
+    RM_CARVE(work, rm->nresources * sizeof(int));
+    RM_CARVE(scratch_order, rows * sizeof(int));
+    RM_CARVE(scratch_seqwork, table);
+    RM_CARVE(finished, rows * sizeof(int));
+    RM_CARVE(stack, rows * sizeof(int));
+    RM_CARVE(frontier, (rm->nresources + rows) * sizeof(struct wait_cursor));
+#undef RM_CARVE
+    return used;
+}
+
+
+// Sets up the manager for simpids 1 to nprocs and nresources resource classes with the given totals, using the
+// rows of max (ROW_STRIDE(nresources) ints apart) as the table of maximum claims.
+// Returns 0, or -1 if the tables could not be allocated.
+static inline int rm_init(struct resource_manager *rm, int nprocs, int nresources, int *total, int *max)
+{
+    size_t bytes;
+    int r;
+
+    memset(rm, 0, sizeof(*rm));
+    rm->nprocs = nprocs;
+    rm->nresources = nresources;
+    rm->stride = ROW_STRIDE(nresources);
+    rm->procwords = BITWORDS(nprocs + 1);
+    rm->reswords = BITWORDS(nresources);
+    rowops_init();
+    bytes = rm_layout(rm, NULL);
+    if (posix_memalign(&rm->arena, CACHELINE, bytes) != 0)
+    {
+        return -1;
+    }
+    memset(rm->arena, 0, bytes);
+    rm_layout(rm, rm->arena);
+
+    for (r = 0; r < nresources; r++)
+    {
+        rm->queues[r].heap = rm->queue_slots + (size_t)r * (nprocs + 1);
+    }
+    memcpy(rm->total, total, nresources * sizeof(int));
+    memcpy(rm->available, total, nresources * sizeof(int));
+    rm->max = max;
+    return 0;
+}
+
+
+// Frees the tables rm_init allocated
+static inline void rm_free(struct resource_manager *rm)
+{
+    free(rm->arena);
+}
+
+
+// Starts tracking a newly launched simpid. Its maximum claim must already be in the table.
+// A claim larger than the system's total could never be satisfied and would make every state unsafe,
+// so claims are capped at the total. The new process holds nothing, so it can always run last: everything
+// is free by then.
+static inline void rm_admit(struct resource_manager *rm, int simpid)
+{
+    rowops.clamp(RM_ROW(rm, rm->max, simpid), rm->total, rm->stride);
+    memset(RM_ROW(rm, rm->allocation, simpid), 0, rm->nresources * sizeof(int));
+    rm->active[simpid] = 1;
+    rm->born[simpid] = rm->admissions++;
+    rm->service[simpid] = 0;
+    rm->position[simpid] = rm->norder;
+    rm->order[rm->norder] = simpid;
+    memcpy(RM_ROW(rm, rm->seqwork, rm->norder), rm->total, rm->nresources * sizeof(int));
+    rm->norder++;
+}
+
+
+// The full Banker's safety check: repeatedly finds a process whose remaining need fits in what is free,
+// lets it finish and reclaims its allocation, until every process has finished or none can.
+// If the state is safe, the sequence it found replaces the cached one.
+static inline int rm_full_safety_check(struct resource_manager *rm)
+{
+    int *work = rm->work;
+    int *order = rm->scratch_order;
+    int *finished = rm->finished;
+    int *allocation;
+    int n = 0;
+    int progress = 1;
+    int p;
+
+    memcpy(work, rm->available, rm->nresources * sizeof(int));
+    for (p = 0; p <= rm->nprocs; p++)
+    {
+        finished[p] = !rm->active[p];
+    }
+
+    while (n < rm->norder && progress)
+    {
+        progress = 0;
+        for (p = 0; p <= rm->nprocs; p++)
+        {
+            if (finished[p])
+            {
+                continue;
+            }
+            allocation = RM_ROW(rm, rm->allocation, p);
+            if (rowops.fits(RM_ROW(rm, rm->max, p), allocation, work, rm->stride))
+            {
+                memcpy(RM_ROW(rm, rm->scratch_seqwork, n), work, rm->stride * sizeof(int));
+                order[n++] = p;
+                rowops.add(work, allocation, rm->stride);
+                finished[p] = 1;
+                progress = 1;
+            }
+        }
+    }
+    if (n < rm->norder)
+    {
+        return 0;
+    }
+
+    memcpy(rm->order, order, n * sizeof(int));
+    memcpy(rm->seqwork, rm->scratch_seqwork, (size_t)n * rm->stride * sizeof(int));
+    for (p = 0; p < n; p++)
+    {
+        rm->position[order[p]] = p;
+    }
+    return 1;
+}
+
+
+// Checks whether the cached safe sequence survives giving simpid every pair of a batch
+static inline int rm_sequence_allows(struct resource_manager *rm, int simpid, const struct batch_item *items,
+                                     int nitems)
+{
+    int i, j, q, r;
+    int k = rm->position[simpid];
+
+    for (i = 0; i < k; i++)
+    {
+        q = rm->order[i];
+        for (j = 0; j < nitems; j++)
+        {
+            r = items[j].resource;
+            if (RM_ROW(rm, rm->max, q)[r] - RM_ROW(rm, rm->allocation, q)[r] >
+                RM_ROW(rm, rm->seqwork, i)[r] - items[j].count)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+// Checks that every pair of a batch fits in work
+static inline int rm_batch_fits(const struct batch_item *items, int nitems, const int *work)
+{
+    int j;
+
+    for (j = 0; j < nitems; j++)
+    {
+        if (items[j].count > work[items[j].resource])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// Moves a batch from available to simpid's allocation, or back again with sign -1
+static inline void rm_batch_apply(struct resource_manager *rm, int simpid, const struct batch_item *items,
+                                  int nitems, int sign)
+{
+    int *allocation = RM_ROW(rm, rm->allocation, simpid);
+    int j;
+
+    for (j = 0; j < nitems; j++)
+    {
+        rm->available[items[j].resource] -= sign * items[j].count;
+        allocation[items[j].resource] += sign * items[j].count;
+    }
+}
+
+
+// Checks a batch simpid asks for against its claims. Returns DENIED if it is empty, names a resource twice or
+// goes past the process's maximum claim, and 0 if it could be granted some time.
+static inline int rm_check_batch(struct resource_manager *rm, int simpid, const struct batch_item *items, int nitems)
+{
+    int *allocation = RM_ROW(rm, rm->allocation, simpid);
+    int *max = RM_ROW(rm, rm->max, simpid);
+    int i, j, r;
+
+    if (nitems <= 0 || nitems > MAXBATCH)
+    {
+        return DENIED;
+    }
+    for (j = 0; j < nitems; j++)
+    {
+        r = items[j].resource;
+        if (r < 0 || r >= rm->nresources || items[j].count <= 0 || allocation[r] + items[j].count > max[r])
+        {
+            return DENIED;
+        }
+        for (i = 0; i < j; i++)
+        {
+            if (items[i].resource == r)
+            {
+                return DENIED;
+            }
+        }
+    }
+    return 0;
+}
+
+
+// Tries to grant simpid every pair of a batch at once. Returns GRANTED if the allocation was made,
+// BLOCKED if the request has to wait, and DENIED if rm_check_batch refuses it.
+// Nothing is allocated unless the whole batch is.
+static inline int rm_try_grant(struct resource_manager *rm, int simpid, const struct batch_item *items, int nitems)
+{
+    int i, j;
+
+    if (rm_check_batch(rm, simpid, items, nitems) == DENIED)
+    {
+        return DENIED;
+    }
+    if (!rm_batch_fits(items, nitems, rm->available))
+    {
+        return BLOCKED;
+    }
+
+    if (rm->detection)
+    {
+        rm_batch_apply(rm, simpid, items, nitems, 1);
+    }
+    else if (rm_sequence_allows(rm, simpid, items, nitems))
+    {
+        rm->fast_checks++;
+        rm_batch_apply(rm, simpid, items, nitems, 1);
+        for (i = 0; i <= rm->position[simpid]; i++)
+        {
+            for (j = 0; j < nitems; j++)
+            {
+                RM_ROW(rm, rm->seqwork, i)[items[j].resource] -= items[j].count;
+            }
+        }
+    }
+    else
+    {
+        rm->full_checks++;
+        rm_batch_apply(rm, simpid, items, nitems, 1);
+        if (!rm_full_safety_check(rm))
+        {
+            rm_batch_apply(rm, simpid, items, nitems, -1);
+            return BLOCKED;
+        }
+    }
+    for (j = 0; j < nitems; j++)
+    {
+        bit_set(RM_HOLDERS(rm, items[j].resource), simpid);
+        rm->service[simpid] += items[j].count;
+    }
+    rm->grants++;
+    return GRANTED;
+}
+
+
+// Whether waiting simpid a comes before b in the grant order
+static inline int rm_wait_before(struct resource_manager *rm, int a, int b)
+{
+    return rm->wait_key[a] < rm->wait_key[b] ||
+           (rm->wait_key[a] == rm->wait_key[b] && rm->wait_seq[a] < rm->wait_seq[b]);
+}
+
+
+// Moves the waiter at index i of q up or down until the heap is in order again, keeping heap_pos up to date
+static inline void rm_heap_fix(struct resource_manager *rm, struct wait_queue *q, int i)
+{
+    int simpid = q->heap[i];
+    int parent, child;
+
+    while (i > 0 && rm_wait_before(rm, simpid, q->heap[parent = (i - 1) / 2]))
+    {
+        q->heap[i] = q->heap[parent];
+        rm->heap_pos[q->heap[i]] = i;
+        i = parent;
+    }
+    while ((child = 2 * i + 1) < q->count)
+    {
+        if (child + 1 < q->count && rm_wait_before(rm, q->heap[child + 1], q->heap[child]))
+        {
+            child++;
+        }
+        if (!rm_wait_before(rm, q->heap[child], simpid))
+        {
+            break;
+        }
+        q->heap[i] = q->heap[child];
+        rm->heap_pos[q->heap[i]] = i;
+        i = child;
+    }
+    q->heap[i] = simpid;
+    rm->heap_pos[simpid] = i;
+}
+
+
+// The key simpid's blocked request msg waits under in the grant policy's order. A request only waits while
+// nothing moves in or out of its process's hand, so the key holds for as long as it waits. Under GRANT_AGING
+// a waiter's priority at time t is its remaining claim less (t - timestamp) / RM_AGING_NS; every waiter's
+// priority falls at the same rate, so ordering them at any time is ordering them by timestamp / RM_AGING_NS
+// plus remaining claim, which is fixed.
+static inline long long rm_wait_key(struct resource_manager *rm, const struct mesg_buf *msg)
+{
+    int *max = RM_ROW(rm, rm->max, msg->simpid);
+    int *allocation = RM_ROW(rm, rm->allocation, msg->simpid);
+    long long remaining = 0, claim = 0;
+    int r;
+
+    if (rm->grant_policy == GRANT_FIFO)
+    {
+        return 0;
+    }
+    for (r = 0; r < rm->nresources; r++)
+    {
+        remaining += max[r] - allocation[r];
+        claim += max[r];
+    }
+    if (rm->grant_policy == GRANT_SRCF)
+    {
+        return remaining;
+    }
+    if (rm->grant_policy == GRANT_AGING)
+    {
+        return (long long)msg->timestamp + remaining * RM_AGING_NS;
+    }
+    return rm->service[msg->simpid] * RM_FAIR_SCALE / (claim > 0 ? claim : 1);
+}
+
+
+// Handles a request message. If it has to wait, it is queued with the other waiters for its first resource,
+// and rm_wake will hand it back once it is granted. A request that is safe to grant now is granted even if
+// others are waiting on the same resource: the waiters are only waiting because granting them is unsafe, and
+// holding back a safe request behind them can deadlock the processes the waiters are waiting on.
+static inline int rm_request(struct resource_manager *rm, struct mesg_buf *msg)
+{
+    struct wait_queue *q;
+    int result;
+
+    result = rm_try_grant(rm, msg->simpid, msg->items, msg->nitems);
+    if (result == BLOCKED)
+    {
+        q = &rm->queues[msg->items[0].resource];
+        rm->wait_key[msg->simpid] = rm_wait_key(rm, msg);
+        rm->wait_seq[msg->simpid] = rm->block_events;
+        q->heap[q->count++] = msg->simpid;
+        rm_heap_fix(rm, q, q->count - 1);
+        bit_set(rm->waiting, msg->items[0].resource);
+        rm->pending[msg->simpid] = *msg;
+        rm->tried[msg->simpid] = rm->epoch;
+        bit_set(rm->blocked, msg->simpid);
+        rm->block_events++;
+    }
+    return result;
+}
+
+
+// Returns count instances of resource from simpid. Releases of instances the process doesn't hold are ignored,
+// so the number actually released is returned.
+static inline int rm_release(struct resource_manager *rm, int simpid, int resource, int count)
+{
+    int *allocation;
+    int i;
+
+    if (resource < 0 || resource >= rm->nresources || count <= 0)
+    {
+        return 0;
+    }
+    allocation = RM_ROW(rm, rm->allocation, simpid);
+    if (count > allocation[resource])
+    {
+        count = allocation[resource];
+    }
+    allocation[resource] -= count;
+    rm->available[resource] += count;
+    rm->epoch++;
+    if (allocation[resource] == 0)
+    {
+        bit_clear(RM_HOLDERS(rm, resource), simpid);
+    }
+    if (!rm->detection)
+    {
+        for (i = 0; i <= rm->position[simpid]; i++)
+        {
+            RM_ROW(rm, rm->seqwork, i)[resource] += count;
+        }
+    }
+    return count;
+}
+
+
+// Reclaims everything simpid holds and stops tracking it
+static inline void rm_terminate(struct resource_manager *rm, int simpid)
+{
+    int *allocation = RM_ROW(rm, rm->allocation, simpid);
+    int i, r;
+    int k = rm->position[simpid];
+
+    // everyone ahead of simpid in the sequence now has its allocation free to them as well
+    for (i = 0; i < k; i++)
+    {
+        rowops.add(RM_ROW(rm, rm->seqwork, i), allocation, rm->stride);
+    }
+    for (i = k; i < rm->norder - 1; i++)
+    {
+        rm->order[i] = rm->order[i + 1];
+        rm->position[rm->order[i]] = i;
+    }
+    memmove(RM_ROW(rm, rm->seqwork, k), RM_ROW(rm, rm->seqwork, k + 1),
+            (size_t)(rm->norder - 1 - k) * rm->stride * sizeof(int));
+    rm->norder--;
+    rm->epoch++;
+
+    rowops.add(rm->available, allocation, rm->stride);
+    memset(allocation, 0, rm->stride * sizeof(int));
+    for (r = 0; r < rm->nresources; r++)
+    {
+        bit_clear(RM_HOLDERS(rm, r), simpid);
+    }
+    rm->active[simpid] = 0;
+}
+
+
+// Removes the waiter at index i of the heap for resource, moving the last waiter into its place
+static inline void rm_dequeue(struct resource_manager *rm, int resource, int i)
+{
+    struct wait_queue *q = &rm->queues[resource];
+
+    bit_clear(rm->blocked, q->heap[i]);
+    if (--q->count == 0)
+    {
+        bit_clear(rm->waiting, resource);
+    }
+    else if (i < q->count)
+    {
+        q->heap[i] = q->heap[q->count];
+        rm_heap_fix(rm, q, i);
+    }
+}
+
+
+// Whether cursor a points at a waiter that comes before cursor b's
+static inline int rm_cursor_before(struct resource_manager *rm, struct wait_cursor a, struct wait_cursor b)
+{
+    return rm_wait_before(rm, rm->queues[a.resource].heap[a.index], rm->queues[b.resource].heap[b.index]);
+}
+
+
+// Adds a cursor to the n in rm_wake's frontier, a min-heap by the waiters they point at
+static inline void rm_cursor_push(struct resource_manager *rm, int *n, int resource, int index)
+{
+    struct wait_cursor c = {resource, index};
+    struct wait_cursor *f = rm->frontier;
+    int i, parent;
+
+    for (i = (*n)++; i > 0 && rm_cursor_before(rm, c, f[parent = (i - 1) / 2]); i = parent)
+    {
+        f[i] = f[parent];
+    }
+    f[i] = c;
+}
+
+
+// Takes the cursor at the earliest waiter out of the frontier
+static inline struct wait_cursor rm_cursor_pop(struct resource_manager *rm, int *n)
+{
+    struct wait_cursor *f = rm->frontier;
+    struct wait_cursor top = f[0], last = f[--(*n)];
+    int i, child;
+
+    for (i = 0; (child = 2 * i + 1) < *n; i = child)
+    {
+        if (child + 1 < *n && rm_cursor_before(rm, f[child + 1], f[child]))
+        {
+            child++;
+        }
+        if (!rm_cursor_before(rm, f[child], last))
+        {
+            break;
+        }
+        f[i] = f[child];
+    }
+    f[i] = last;
+    return top;
+}
+
+
+// Retries the waiters of every queue in the grant policy's order, skipping those already found ungrantable
+// since the last release. If one of them can now be granted, it is removed from its queue, its request is
+// copied into msg and 1 is returned. Call it until it returns 0 after every release or termination.
+// The frontier starts at the root of every queue's heap. Taking a waiter out of it puts its children in, so the
+// waiters come out in order and only as many are looked at as it takes to find one that fits.
+static inline int rm_wake(struct resource_manager *rm, struct mesg_buf *msg)
+{
+    struct wait_queue *q;
+    struct wait_cursor c;
+    int r, simpid, n = 0;
+
+    for (r = bit_next(rm->waiting, rm->reswords, 0); r != -1; r = bit_next(rm->waiting, rm->reswords, r + 1))
+    {
+        rm_cursor_push(rm, &n, r, 0);
+    }
+    while (n > 0)
+    {
+        c = rm_cursor_pop(rm, &n);
+        q = &rm->queues[c.resource];
+        simpid = q->heap[c.index];
+        if (rm->tried[simpid] != rm->epoch)
+        {
+            if (rm_try_grant(rm, simpid, rm->pending[simpid].items, rm->pending[simpid].nitems) == GRANTED)
+            {
+                rm_dequeue(rm, c.resource, c.index);
+                *msg = rm->pending[simpid];
+                return 1;
+            }
+            rm->tried[simpid] = rm->epoch;
+        }
+        if (2 * c.index + 1 < q->count)
+        {
+            rm_cursor_push(rm, &n, c.resource, 2 * c.index + 1);
+        }
+        if (2 * c.index + 2 < q->count)
+        {
+            rm_cursor_push(rm, &n, c.resource, 2 * c.index + 2);
+        }
+    }
+    return 0;
+}
+
+
+// Takes a blocked simpid out of the queue it is waiting in, so it can be terminated. A manager whose blocked
+// set was copied in from elsewhere (shard_sync) has no queues behind it, so the heap is checked to really hold
+// simpid where heap_pos says before anything is taken out of it.
+static inline void rm_cancel_wait(struct resource_manager *rm, int simpid)
+{
+    struct wait_queue *q;
+    int i = rm->heap_pos[simpid];
+
+    if (!bit_test(rm->blocked, simpid))
+    {
+        return;
+    }
+    q = &rm->queues[rm->pending[simpid].items[0].resource];
+    if (i >= 0 && i < q->count && q->heap[i] == simpid)
+    {
+        rm_dequeue(rm, rm->pending[simpid].items[0].resource, i);
+    }
+}
+
+
+// Finds the deadlocked simpids by reducing the wait-for graph. Every running process that isn't blocked can
+// run to completion and hand back what it holds, which may let some of the waiters finish as well. Whatever is
+// still blocked once nothing more can finish is deadlocked. The deadlocked set is left in dead
+// (rm->procwords words) and its size is returned.
+// A waiter's batch can be short on any of its resources, not just the one it is queued on, so every
+// remaining waiter is rechecked after each process finishes.
+static inline int rm_detect(struct resource_manager *rm, uint64_t *dead)
+{
+    int *work = rm->work;
+    int *stack = rm->stack;
+    int top = 0;
+    int p, waiter;
+
+    memcpy(work, rm->available, rm->nresources * sizeof(int));
+    memcpy(dead, rm->blocked, rm->procwords * sizeof(uint64_t));
+
+    for (p = 0; p <= rm->nprocs; p++)
+    {
+        if (rm->active[p] && (!bit_test(dead, p) ||
+                              rm_batch_fits(rm->pending[p].items, rm->pending[p].nitems, work)))
+        {
+            bit_clear(dead, p);
+            stack[top++] = p;
+        }
+    }
+
+    while (top > 0)
+    {
+        p = stack[--top];
+        rowops.add(work, RM_ROW(rm, rm->allocation, p), rm->stride);
+        for (waiter = bit_next(dead, rm->procwords, 0); waiter != -1;
+             waiter = bit_next(dead, rm->procwords, waiter + 1))
+        {
+            if (rm_batch_fits(rm->pending[waiter].items, rm->pending[waiter].nitems, work))
+            {
+                bit_clear(dead, waiter);
+                stack[top++] = waiter;
+            }
+        }
+    }
+    return bit_count(dead, rm->procwords);
+}
+
+
+// Fills in waits_for with the deadlocked simpids that hold a resource simpid is short of:
+// its edges in the wait-for graph restricted to the deadlocked set.
+static inline void rm_waits_for(struct resource_manager *rm, int simpid, const uint64_t *dead, uint64_t *waits_for)
+{
+    struct mesg_buf *pending = &rm->pending[simpid];
+    uint64_t *holders;
+    int j, w;
+
+    memset(waits_for, 0, rm->procwords * sizeof(uint64_t));
+    for (j = 0; j < pending->nitems; j++)
+    {
+        if (pending->items[j].count <= rm->available[pending->items[j].resource])
+        {
+            continue;
+        }
+        holders = RM_HOLDERS(rm, pending->items[j].resource);
+        for (w = 0; w < rm->procwords; w++)
+        {
+            waits_for[w] |= holders[w] & dead[w];
+        }
+    }
+    // a process holding part of what it asks for is not waiting on itself
+    bit_clear(waits_for, simpid);
+}
+
+
+// Picks which deadlocked simpid to terminate according to policy. Only processes holding something are
+// considered: a deadlocked process holding nothing is only stuck behind the others, and killing it frees
+// nothing. A deadlocked set always has a holder, or its requests would fit in what is free.
+static inline int rm_choose_victim(struct resource_manager *rm, const uint64_t *dead, int policy)
+{
+    int victim = -1;
+    long score, best = 0, held;
+    int p;
+
+    for (p = bit_next(dead, rm->procwords, 0); p != -1; p = bit_next(dead, rm->procwords, p + 1))
+    {
+        held = rowops.sum(RM_ROW(rm, rm->allocation, p), rm->stride);
+        if (held == 0)
+        {
+            continue;
+        }
+        if (policy == VICTIM_LOWEST)
+        {
+            return p;
+        }
+        score = policy == VICTIM_YOUNGEST ? -rm->born[p] : held;
+        if (victim == -1 || score < best)
+        {
+            victim = p;
+            best = score;
+        }
+    }
+    return victim;
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * A shared-memory transport for OSS and User, used instead of the message queue when OSS is run with -r.
+ * Every simpid owns one channel: a single-producer/single-consumer ring carrying its requests to the master,
+ * and a reply slot the master fills in before waking the user through a futex on reply_seq.
+ * The channels live in the region OSS shares with its users (region.h), after the process table.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "message.h"
+
+#define RING_SLOTS 4            // a user has at most one request outstanding, so this never fills
+#define TRANSPORT_QUEUE 0
+#define TRANSPORT_RING 1
+
+struct spsc_ring {
+    unsigned int head;                              // next slot to write, only advanced by the user
+    char pad_head[CACHELINE - sizeof(unsigned int)];
+    unsigned int tail;                              // next slot to read, only advanced by the master
+    char pad_tail[CACHELINE - sizeof(unsigned int)];
+    struct mesg_buf slots[RING_SLOTS];
+};
+
+struct ring_channel {
+    struct spsc_ring requests;                      // user -> master
+    unsigned int reply_seq;                         // futex word, bumped by the master for every reply
+    char pad_seq[CACHELINE - sizeof(unsigned int)];
+    struct mesg_buf reply;                          // master -> user
+} __attribute__((aligned(CACHELINE)));
+
+
+static inline long futex_wait(unsigned int *addr, unsigned int expected)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+
+// futex_wait that gives up after ms milliseconds
+static inline long futex_wait_ms(unsigned int *addr, unsigned int expected, int ms)
+{
+    struct timespec timeout = { ms / 1000, (ms % 1000) * 1000000L };
+
+    return syscall(SYS_futex, addr, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+
+static inline long futex_wake(unsigned int *addr, int count)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+
+// Clears a channel so a new user can take over the simpid. reply_seq keeps counting: the process before may
+// still be on its way out of ring_await_reply with the reply to its termination, and would sleep forever if
+// the count went back to what it last saw. A new user starts from wherever reply_seq stands.
+static inline void ring_reset(struct ring_channel *chan)
+{
+    __atomic_store_n(&chan->requests.head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&chan->requests.tail, 0, __ATOMIC_RELEASE);
+}
+
+
+// Producer side: appends a message, returns 0 if the ring was full
+static inline int ring_push(struct spsc_ring *ring, const struct mesg_buf *msg)
+{
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == RING_SLOTS)
+    {
+        return 0;
+    }
+    ring->slots[head % RING_SLOTS] = *msg;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+// Consumer side: removes the oldest message, returns 0 if the ring was empty
+static inline int ring_pop(struct spsc_ring *ring, struct mesg_buf *msg)
+{
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return 0;
+    }
+    *msg = ring->slots[tail % RING_SLOTS];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+// Master side: posts a reply and wakes the user blocked in ring_await_reply
+static inline void ring_reply(struct ring_channel *chan, const struct mesg_buf *msg)
+{
+    chan->reply = *msg;
+    __atomic_add_fetch(&chan->reply_seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&chan->reply_seq, INT_MAX);
+}
+
+
+// User side: blocks until the master posts a reply after sequence number seen, then copies it out.
+// Returns the new sequence number, which the caller passes back in for its next request.
+static inline unsigned int ring_await_reply(struct ring_channel *chan, unsigned int seen, struct mesg_buf *msg)
+{
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&chan->reply_seq, __ATOMIC_ACQUIRE)) == seen)
+    {
+        futex_wait(&chan->reply_seq, seen);
+    }
+    *msg = chan->reply;
+    return seq;
+}
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Elementwise kernels over the per-process resource rows: the claim rows of the shared process table, the
+ * resource manager's allocation and work rows, and a user's own holdings. Every row is padded out to
+ * ROW_STRIDE ints with zeroes (see proctable.h), so the kernels always run over whole vectors and need no
+ * scalar tail. n must be a row stride, a multiple of 16.
+ *
+ * Each kernel comes in a scalar, an SSE2 and an AVX2 version. rowops starts out pointing at the scalar ones;
+ * rowops_init switches it to the widest set the CPU supports. ROWOPS in the environment (scalar, sse2 or
+ * avx2) overrides the choice.
+ */
+
+#ifndef ROWOPS_H
+#define ROWOPS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROWOPS_X86 1
+#endif
+
+struct row_ops {
+    const char *name;
+    int (*fits)(const int *max, const int *allocation, const int *work, int n); // max[i] - allocation[i] <= work[i]
+    void (*add)(int *dst, const int *src, int n);                           // dst[i] += src[i]
+    void (*clamp)(int *dst, const int *limit, int n);                       // dst[i] = min(dst[i], limit[i])
+    long (*sum)(const int *a, int n);                                       // a[0] + ... + a[n - 1]
+};
+
+
+static int row_fits_scalar(const int *max, const int *allocation, const int *work, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (max[i] - allocation[i] > work[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void row_add_scalar(int *dst, const int *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        dst[i] += src[i];
+    }
+}
+
+
+static void row_clamp_scalar(int *dst, const int *limit, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (dst[i] > limit[i])
+        {
+            dst[i] = limit[i];
+        }
+    }
+}
+
+
+static long row_sum_scalar(const int *a, int n)
+{
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        sum += a[i];
+    }
+    return sum;
+}
+
+
+static const struct row_ops rowops_scalar = {
+    "scalar", row_fits_scalar, row_add_scalar, row_clamp_scalar, row_sum_scalar
+};
+
+#ifdef ROWOPS_X86
+
+__attribute__((target("sse2"))) static int row_fits_sse2(const int *max, const int *allocation, const int *work,
+                                                         int n)
+{
+    __m128i need, over;
+    int i;
+
+    for (i = 0; i < n; i += 4)
+    {
+        need = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(max + i)),
+                             _mm_loadu_si128((const __m128i *)(allocation + i)));
+        over = _mm_cmpgt_epi32(need, _mm_loadu_si128((const __m128i *)(work + i)));
+        if (_mm_movemask_epi8(over))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+__attribute__((target("sse2"))) static void row_add_sse2(int *dst, const int *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i += 4)
+    {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(dst + i)),
+                                                             _mm_loadu_si128((const __m128i *)(src + i))));
+    }
+}
+
+
+// SSE2 has no 32-bit min, so this selects with a compare and and/andnot/or
+__attribute__((target("sse2"))) static void row_clamp_sse2(int *dst, const int *limit, int n)
+{
+    __m128i d, l, over;
+    int i;
+
+    for (i = 0; i < n; i += 4)
+    {
+        d = _mm_loadu_si128((const __m128i *)(dst + i));
+        l = _mm_loadu_si128((const __m128i *)(limit + i));
+        over = _mm_cmpgt_epi32(d, l);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_and_si128(over, l), _mm_andnot_si128(over, d)));
+    }
+}
+
+
+__attribute__((target("sse2"))) static long row_sum_sse2(const int *a, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int lanes[4];
+    int i;
+
+    for (i = 0; i < n; i += 4)
+    {
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i *)(a + i)));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+
+__attribute__((target("avx2"))) static int row_fits_avx2(const int *max, const int *allocation, const int *work,
+                                                         int n)
+{
+    __m256i need, over;
+    int i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        need = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(max + i)),
+                                _mm256_loadu_si256((const __m256i *)(allocation + i)));
+        over = _mm256_cmpgt_epi32(need, _mm256_loadu_si256((const __m256i *)(work + i)));
+        if (!_mm256_testz_si256(over, over))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+__attribute__((target("avx2"))) static void row_add_avx2(int *dst, const int *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(dst + i)),
+                                             _mm256_loadu_si256((const __m256i *)(src + i))));
+    }
+}
+
+
+__attribute__((target("avx2"))) static void row_clamp_avx2(int *dst, const int *limit, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_min_epi32(_mm256_loadu_si256((const __m256i *)(dst + i)),
+                                             _mm256_loadu_si256((const __m256i *)(limit + i))));
+    }
+}
+
+
+__attribute__((target("avx2"))) static long row_sum_avx2(const int *a, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m128i half;
+    int lanes[4];
+    int i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i *)(a + i)));
+    }
+    half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    _mm_storeu_si128((__m128i *)lanes, half);
+    return (long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+
+static const struct row_ops rowops_sse2 = {
+    "sse2", row_fits_sse2, row_add_sse2, row_clamp_sse2, row_sum_sse2
+};
+
+static const struct row_ops rowops_avx2 = {
+    "avx2", row_fits_avx2, row_add_avx2, row_clamp_avx2, row_sum_avx2
+};
+
+#endif
+
+// The kernels in use. Usable before rowops_init, which only swaps in faster ones.
+static struct row_ops rowops = {
+    "scalar", row_fits_scalar, row_add_scalar, row_clamp_scalar, row_sum_scalar
+};
+
+
+// Returns the kernel set with the given name if this CPU can run it, NULL otherwise
+static inline const struct row_ops *rowops_find(const char *name)
+{
+    if (strcmp(name, "scalar") == 0)
+    {
+        return &rowops_scalar;
+    }
+#ifdef ROWOPS_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    {
+        return &rowops_sse2;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+        return &rowops_avx2;
+    }
+#endif
+    return NULL;
+}
+
+
+// Picks the kernels for this CPU, or the ones named by ROWOPS if it can run them
+static inline void rowops_init()
+{
+    const char *forced = getenv("ROWOPS");
+    const struct row_ops *ops = NULL;
+
+    if (forced != NULL)
+    {
+        ops = rowops_find(forced);
+    }
+    if (ops == NULL && (ops = rowops_find("avx2")) == NULL && (ops = rowops_find("sse2")) == NULL)
+    {
+        ops = &rowops_scalar;
+    }
+    rowops = *ops;
+}
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The sharded resource manager OSS uses with -k. Resource classes are dealt out to the shards round-robin,
+ * class r to shard r % nshards as its local class r / nshards, and every shard is a resource_manager of its own
+ * over its classes, with its own wait queues, its own lock and its own thread (see oss.c). A request for the
+ * classes of one shard is decided by that shard alone. A request that spans shards is acquired one shard at a
+ * time in ascending shard order, keeping what it got from the lower shards while it waits in a higher one.
+ * Whoever carries a request on to the next shard takes that shard's lock while holding the last one, and
+ * every thread takes shard locks in ascending order, so the shards can't deadlock each other.
+ *
+ * Sharding only works with deadlock detection. The Banker's safety check looks at every class at once, so an
+ * avoidance grant would need every shard's lock and there would be nothing left to split. The processes can
+ * still deadlock over what they hold, as in any detection run: a detection pass takes every shard's lock and
+ * copies the shards into the master's whole-system resource_manager with shard_sync, where rm_detect runs
+ * as usual.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "message.h"
+#include "resource.h"
+#include "pipeline.h"
+
+#define MAX_SHARDS 16
+
+// What can become of a request in the shards, besides GRANTED, BLOCKED and DENIED from resource.h
+#define SHARD_UNBLOCKED 4       // a request that had to wait has been granted in full
+#define SHARD_RELEASED 5        // a release has been carried out
+
+// Resource r's shard, and its number within the shard
+#define SHARD_OF(set, r) ((r) % (set)->nshards)
+#define SHARD_LOCAL(set, r) ((r) / (set)->nshards)
+
+struct shard {
+    pthread_mutex_t lock;
+    struct resource_manager rm;         // over the shard's classes, numbered locally
+    int *max;                           // rm's claims: the shard's columns of every simpid's maximum claim
+    struct spsc_queue inbox;            // simpids whose request the master routed here, master -> shard
+    struct spsc_queue outcomes;         // what became of them, shard -> master
+    struct bell bell;                   // rung by the master
+    pthread_t thread;
+} __attribute__((aligned(CACHELINE)));
+
+// A request or release on its way through the shards. Only one thread at a time works on it: the master until
+// it is routed, then whoever holds the lock of the shard it has got to.
+struct shard_request {
+    struct mesg_buf msg;                // as the user sent it, numbered globally
+    long long received;                 // wall ns the master received it
+    int blocked;                        // it has had to wait in some shard
+};
+
+// What became of a request, for the master to log and count
+struct shard_outcome {
+    struct mesg_buf msg;
+    int result;                         // GRANTED, BLOCKED, DENIED, SHARD_UNBLOCKED or SHARD_RELEASED
+    long long received;
+    uint64_t clock;                     // the simulated time it happened
+    long long at;                       // and the wall time
+};
+
+struct shard_set {
+    int nshards;
+    int nresources;
+    int nprocs;
+    int done;                           // set when the run is over, every shard thread exits
+    int nblocked;                       // requests waiting in some shard
+    long routed;                        // requests and releases the master has routed to a shard
+    long spanning;                      // those that spanned more than one
+    struct shard *shards;
+    struct shard_request *inflight;     // each simpid's request in progress
+};
+
+
+// Splits nresources classes with the given totals into nshards shards, each granting without the safety check
+// and waking its waiters in the order of grant_policy. Returns 0, or -1 if something can't be allocated.
+static inline int shard_set_init(struct shard_set *set, int nshards, int nprocs, int nresources, const int *total,
+                                 int grant_policy)
+{
+    int local[nresources];
+    struct shard *sh;
+    int s, l, n;
+
+    memset(set, 0, sizeof(*set));
+    set->nshards = nshards;
+    set->nresources = nresources;
+    set->nprocs = nprocs;
+    set->inflight = calloc(nprocs + 1, sizeof(struct shard_request));
+    if (set->inflight == NULL ||
+        posix_memalign((void **)&set->shards, CACHELINE, nshards * sizeof(struct shard)) != 0)
+    {
+        return -1;
+    }
+    memset(set->shards, 0, nshards * sizeof(struct shard));
+    for (s = 0; s < nshards; s++)
+    {
+        sh = &set->shards[s];
+        n = 0;
+        for (l = 0; l * nshards + s < nresources; l++)
+        {
+            local[n++] = total[l * nshards + s];
+        }
+        sh->max = calloc((size_t)(nprocs + 1) * ROW_STRIDE(n), sizeof(int));
+        if (sh->max == NULL || rm_init(&sh->rm, nprocs, n, local, sh->max) == -1 ||
+            spsc_init(&sh->inbox, nprocs + 1, sizeof(int)) == -1 ||
+            spsc_init(&sh->outcomes, 4 * (nprocs + 1), sizeof(struct shard_outcome)) == -1)
+        {
+            return -1;
+        }
+        sh->rm.detection = 1;
+        sh->rm.grant_policy = grant_policy;
+        pthread_mutex_init(&sh->lock, NULL);
+    }
+    return 0;
+}
+
+
+static inline void shard_set_free(struct shard_set *set)
+{
+    int s;
+
+    for (s = 0; s < set->nshards; s++)
+    {
+        rm_free(&set->shards[s].rm);
+        free(set->shards[s].max);
+        spsc_free(&set->shards[s].inbox);
+        spsc_free(&set->shards[s].outcomes);
+        pthread_mutex_destroy(&set->shards[s].lock);
+    }
+    free(set->shards);
+    free(set->inflight);
+}
+
+
+// Takes every shard's lock, in ascending order like everyone else
+static inline void shard_lock_all(struct shard_set *set)
+{
+    int s;
+
+    for (s = 0; s < set->nshards; s++)
+    {
+        pthread_mutex_lock(&set->shards[s].lock);
+    }
+}
+
+
+static inline void shard_unlock_all(struct shard_set *set)
+{
+    int s;
+
+    for (s = set->nshards - 1; s >= 0; s--)
+    {
+        pthread_mutex_unlock(&set->shards[s].lock);
+    }
+}
+
+
+// The lowest shard above after that msg has a pair in, or -1 if there is none. Pass -1 to get the first.
+// Pairs naming no resource belong to no shard.
+static inline int shard_next(struct shard_set *set, const struct mesg_buf *msg, int after)
+{
+    int next = -1;
+    int j, r, s;
+
+    for (j = 0; j < msg->nitems; j++)
+    {
+        r = msg->items[j].resource;
+        s = SHARD_OF(set, r);
+        if (r >= 0 && r < set->nresources && s > after && (next == -1 || s < next))
+        {
+            next = s;
+        }
+    }
+    return next;
+}
+
+
+// Fills part with msg's pairs in shard s, numbered locally, and returns how many there are
+static inline int shard_part(struct shard_set *set, const struct mesg_buf *msg, int s, struct mesg_buf *part)
+{
+    int j;
+
+    *part = *msg;
+    part->nitems = 0;
+    for (j = 0; j < msg->nitems; j++)
+    {
+        if (msg->items[j].resource >= 0 && msg->items[j].resource < set->nresources &&
+            SHARD_OF(set, msg->items[j].resource) == s)
+        {
+            part->items[part->nitems].resource = SHARD_LOCAL(set, msg->items[j].resource);
+            part->items[part->nitems].count = msg->items[j].count;
+            part->nitems++;
+        }
+    }
+    return part->nitems;
+}
+
+
+// Checks a request against simpid's claims in every shard it spans, as rm_check_batch does for one manager.
+// The caller holds the lock of every shard msg has a pair in.
+static inline int shard_check(struct shard_set *set, const struct mesg_buf *msg)
+{
+    struct mesg_buf part;
+    int j, s;
+
+    if (msg->nitems <= 0 || msg->nitems > MAXBATCH)
+    {
+        return DENIED;
+    }
+    for (j = 0; j < msg->nitems; j++)
+    {
+        if (msg->items[j].resource < 0 || msg->items[j].resource >= set->nresources)
+        {
+            return DENIED;
+        }
+    }
+    for (s = shard_next(set, msg, -1); s != -1; s = shard_next(set, msg, s))
+    {
+        shard_part(set, msg, s, &part);
+        if (rm_check_batch(&set->shards[s].rm, msg->simpid, part.items, part.nitems) == DENIED)
+        {
+            return DENIED;
+        }
+    }
+    return 0;
+}
+
+
+// Starts tracking simpid in every shard, with its maximum claim taken from the row claims of the process table.
+// The caller holds every shard's lock.
+static inline void shard_admit(struct shard_set *set, int simpid, const int *claims)
+{
+    struct shard *sh;
+    int s, l;
+
+    for (s = 0; s < set->nshards; s++)
+    {
+        sh = &set->shards[s];
+        for (l = 0; l < sh->rm.nresources; l++)
+        {
+            RM_ROW(&sh->rm, sh->max, simpid)[l] = claims[l * set->nshards + s];
+        }
+        rm_admit(&sh->rm, simpid);
+    }
+}
+
+
+// Takes simpid out of any shard's wait queue it is in and reclaims everything it holds in every shard.
+// The caller holds every shard's lock, and wakes the waiters of every shard afterwards.
+static inline void shard_terminate(struct shard_set *set, int simpid)
+{
+    struct resource_manager *srm;
+    int s;
+
+    for (s = 0; s < set->nshards; s++)
+    {
+        srm = &set->shards[s].rm;
+        if (bit_test(srm->blocked, simpid))
+        {
+            rm_cancel_wait(srm, simpid);
+            __atomic_sub_fetch(&set->nblocked, 1, __ATOMIC_RELAXED);
+        }
+        rm_terminate(srm, simpid);
+    }
+}
+
+
+// Copies what the shards hold and wait for into the whole-system manager rm, numbered globally, so rm_detect,
+// rm_waits_for and rm_choose_victim can run on it. rm keeps its own active set and admission order.
+// The caller holds every shard's lock.
+static inline void shard_sync(struct shard_set *set, struct resource_manager *rm)
+{
+    struct resource_manager *srm;
+    struct mesg_buf *pending;
+    int s, l, r, p, j;
+
+    memset(rm->blocked, 0, rm->procwords * sizeof(uint64_t));
+    for (s = 0; s < set->nshards; s++)
+    {
+        srm = &set->shards[s].rm;
+        for (l = 0; l < srm->nresources; l++)
+        {
+            r = l * set->nshards + s;
+            rm->available[r] = srm->available[l];
+            memcpy(RM_HOLDERS(rm, r), RM_HOLDERS(srm, l), rm->procwords * sizeof(uint64_t));
+        }
+        for (p = 0; p <= rm->nprocs; p++)
+        {
+            for (l = 0; l < srm->nresources; l++)
+            {
+                RM_ROW(rm, rm->allocation, p)[l * set->nshards + s] = RM_ROW(srm, srm->allocation, p)[l];
+            }
+        }
+        // a request waits in one shard at a time, so that shard's part is everything it is waiting for
+        for (p = bit_next(srm->blocked, srm->procwords, 0); p != -1; p = bit_next(srm->blocked, srm->procwords, p + 1))
+        {
+            bit_set(rm->blocked, p);
+            pending = &rm->pending[p];
+            *pending = srm->pending[p];
+            for (j = 0; j < pending->nitems; j++)
+            {
+                pending->items[j].resource = pending->items[j].resource * set->nshards + s;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The master's simpid allocator. Free simpids are kept in a bitmap with a summary word per 64 words of it,
+ * so finding the lowest free simpid is two find-first-set instructions for up to 4096 simpids, and freeing one
+ * is two bit sets. Every time a simpid is handed out its generation is bumped; users stamp their messages
+ * with the generation they were launched under, so a message left over from an earlier process with the
+ * same simpid is told apart with one compare.
+ */
+
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+
+struct slot_allocator {
+    int nslots;                 // slots run from 1 to nslots, slot 0 is never handed out
+    int words;                  // words in free
+    uint64_t *free;             // bit s is set while slot s is free
+    uint64_t *summary;          // bit w is set while free[w] has a bit set
+    unsigned int *generation;   // bumped every time the slot is handed out
+};
+
+
+// Sets up an allocator with slots 1 to nslots all free. Returns 0, or -1 if it could not be allocated.
+static inline int slot_init(struct slot_allocator *sa, int nslots)
+{
+    int s;
+
+    sa->nslots = nslots;
+    sa->words = BITWORDS(nslots + 1);
+    sa->free = calloc(sa->words, sizeof(uint64_t));
+    sa->summary = calloc(BITWORDS(sa->words), sizeof(uint64_t));
+    sa->generation = calloc(nslots + 1, sizeof(unsigned int));
+    if (sa->free == NULL || sa->summary == NULL || sa->generation == NULL)
+    {
+        free(sa->free);
+        free(sa->summary);
+        free(sa->generation);
+        return -1;
+    }
+    for (s = 1; s <= nslots; s++)
+    {
+        bit_set(sa->free, s);
+        bit_set(sa->summary, s / 64);
+    }
+    return 0;
+}
+
+
+static inline void slot_destroy(struct slot_allocator *sa)
+{
+    free(sa->free);
+    free(sa->summary);
+    free(sa->generation);
+}
+
+
+// Takes the lowest free slot and starts a new generation of it. Returns -1 if every slot is taken.
+static inline int slot_alloc(struct slot_allocator *sa)
+{
+    int w = bit_next(sa->summary, BITWORDS(sa->words), 0);
+    int s;
+
+    if (w == -1)
+    {
+        return -1;
+    }
+    s = w * 64 + __builtin_ctzll(sa->free[w]);
+    bit_clear(sa->free, s);
+    if (sa->free[w] == 0)
+    {
+        bit_clear(sa->summary, w);
+    }
+    sa->generation[s]++;
+    return s;
+}
+
+
+// Ends the current generation of a slot without freeing it, so anything its process still sends is dropped
+static inline void slot_retire(struct slot_allocator *sa, int s)
+{
+    sa->generation[s]++;
+}
+
+
+static inline void slot_free(struct slot_allocator *sa, int s)
+{
+    bit_set(sa->free, s);
+    bit_set(sa->summary, s / 64);
+}
+
+
+// Checks that a message from slot s was sent under its current generation
+static inline int slot_current(struct slot_allocator *sa, int s, unsigned int generation)
+{
+    return s >= 1 && s <= sa->nslots && !bit_test(sa->free, s) && sa->generation[s] == generation;
+}
+
+#endif
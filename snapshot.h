@@ -0,0 +1,240 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Snapshots of a discrete-event run (-D) for OSS's -C and -R. In that mode the master holds the whole
+ * simulation: the clock, the resource tables and wait queues, the simpids and their generations, the pending
+ * events, its own PRNG and every process's state machine along with its PRNG. A snapshot is all of that, so a
+ * run restored from one carries on exactly as the run it was taken from would have.
+ *
+ * The file is a snapshot_header, the sections below in order, then an FNV-1a checksum of everything before it:
+ *   the process table, header and rows     proc_table_size bytes
+ *   the resource manager's arena           arena_bytes
+ *   the slot allocator                     its free and summary words, then nprocs + 1 generations
+ *   procarray                              nprocs + 1 ints
+ *   the pending events                     events sim_events, in heap order
+ *   each simpid's process, 1 to nprocs     a snapshot_proc, then its holdings: nresources ints and two sets
+ *
+ * Everything goes through a buffer on the caller's stack and plain read and write, so the writer, a child
+ * forked from the master, never allocates.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "prng.h"
+
+#define SNAPSHOT_MAGIC "OSSSNAPS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BUFSIZE 65536
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    // the run's workload and settings, which a restored run takes instead of its command line's
+    uint64_t seed;
+    double skew;
+    int batch;
+    int terminate;
+    int nprocs;
+    int nresources;
+    int launchms;
+    int detectms;
+    int policy;
+    int grant_policy;
+    uint64_t end;               // simulated ns the run ends at
+    // where the run was
+    uint64_t clock;
+    uint64_t next_launch;       // simulated ns the next launch is due
+    int totalprocs;             // processes running
+    int serial;                 // stand-in pids handed out
+    long handled;               // events taken off the queue
+    long steps;
+    struct prng rng;            // the master's stream
+    uint32_t events;            // events pending
+    uint64_t event_seq;         // events pushed so far
+    // the resource manager's counters, its tables are in its arena
+    uint64_t arena_bytes;
+    int norder;
+    long epoch;
+    long admissions;
+    long block_events;
+    long grants;
+    long fast_checks;
+    long full_checks;
+    // the run's other counters, so its totals carry on too. Its latency histograms start again from the restore.
+    long terminations;
+    long denials;
+    long stale;
+    long messages;
+    long units;
+    long passes;
+    long deadlocks;
+    long victims;
+};
+
+// A process's state machine, less its pointers
+struct snapshot_proc {
+    int simpid;
+    unsigned int generation;
+    int pid;
+    int phase;
+    struct prng rng;
+};
+
+// A snapshot file being written or read, through buf
+struct snapshot_file {
+    int fd;
+    int used;                   // bytes in buf
+    int at;                     // reading: the next byte of buf
+    int error;                  // set once anything has failed or come up short
+    uint64_t hash;              // FNV-1a of every byte so far
+    unsigned char buf[SNAPSHOT_BUFSIZE];
+};
+
+
+static inline void snapshot_hash(struct snapshot_file *sf, const unsigned char *p, size_t bytes)
+{
+    uint64_t hash = sf->hash;
+    size_t i;
+
+    for (i = 0; i < bytes; i++)
+    {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    sf->hash = hash;
+}
+
+
+static inline void snapshot_begin(struct snapshot_file *sf, int fd)
+{
+    sf->fd = fd;
+    sf->used = sf->at = sf->error = 0;
+    sf->hash = 14695981039346656037ULL;
+}
+
+
+static inline void snapshot_flush(struct snapshot_file *sf)
+{
+    ssize_t done;
+    int off = 0;
+
+    while (off < sf->used)
+    {
+        if ((done = write(sf->fd, sf->buf + off, sf->used - off)) <= 0)
+        {
+            sf->error = 1;
+            break;
+        }
+        off += done;
+    }
+    sf->used = 0;
+}
+
+
+static inline void snapshot_put(struct snapshot_file *sf, const void *data, size_t bytes)
+{
+    const unsigned char *p = data;
+    size_t n;
+
+    snapshot_hash(sf, p, bytes);
+    while (bytes > 0)
+    {
+        n = bytes < (size_t)(SNAPSHOT_BUFSIZE - sf->used) ? bytes : (size_t)(SNAPSHOT_BUFSIZE - sf->used);
+        memcpy(sf->buf + sf->used, p, n);
+        sf->used += n;
+        p += n;
+        bytes -= n;
+        if (sf->used == SNAPSHOT_BUFSIZE)
+        {
+            snapshot_flush(sf);
+        }
+    }
+}
+
+
+// Writes the checksum and whatever is left in the buffer. Returns 0, or -1 if anything failed.
+static inline int snapshot_end(struct snapshot_file *sf)
+{
+    uint64_t hash = sf->hash;
+
+    snapshot_put(sf, &hash, sizeof(hash));
+    snapshot_flush(sf);
+    return sf->error ? -1 : 0;
+}
+
+
+// Reads bytes into data, or as many as there are, zeroing the rest and setting error
+static inline void snapshot_get(struct snapshot_file *sf, void *data, size_t bytes)
+{
+    unsigned char *p = data;
+    ssize_t got;
+    size_t n;
+
+    while (bytes > 0)
+    {
+        if (sf->at == sf->used)
+        {
+            sf->at = 0;
+            if ((got = read(sf->fd, sf->buf, SNAPSHOT_BUFSIZE)) <= 0)
+            {
+                sf->used = 0;
+                sf->error = 1;
+                memset(p, 0, bytes);
+                return;
+            }
+            sf->used = got;
+        }
+        n = bytes < (size_t)(sf->used - sf->at) ? bytes : (size_t)(sf->used - sf->at);
+        memcpy(p, sf->buf + sf->at, n);
+        snapshot_hash(sf, p, n);
+        sf->at += n;
+        p += n;
+        bytes -= n;
+    }
+}
+
+
+// Reads the checksum at the end of what has been read and checks it against what was read. Returns 0 if it
+// matches and nothing follows it.
+static inline int snapshot_check(struct snapshot_file *sf)
+{
+    uint64_t expected = sf->hash, stored;
+    char extra;
+
+    snapshot_get(sf, &stored, sizeof(stored));
+    if (sf->error || stored != expected)
+    {
+        return -1;
+    }
+    snapshot_get(sf, &extra, 1);
+    return sf->error ? 0 : -1;
+}
+
+
+// Opens path and reads its header, checking it is a snapshot this build can restore. Returns 0, or -1.
+static inline int snapshot_open(struct snapshot_file *sf, const char *path, struct snapshot_header *header)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+    snapshot_begin(sf, fd);
+    snapshot_get(sf, header, sizeof(*header));
+    if (sf->error || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->header_size != sizeof(*header))
+    {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * The parameter grid and core groups of OSS's sweep mode (-G). A grid is a list of axes separated by spaces,
+ * each an option letter and the values to run it with, like "s=8,16,32 S=1..4 r=-,on". Every combination of
+ * one value from each axis is one run of OSS with the rest of the command line. A value of - leaves the option
+ * off, an integer range a..b stands for every integer from a to b, and an option that takes no argument, like
+ * -r, is passed for any other value.
+ *
+ * Runs go on at once, each with its own core group: the CPUs this process may use, ordered by NUMA node and
+ * split evenly between the runs going on at once. A run's master and every user it forks stay on its group, so
+ * runs don't steal each other's cores or caches, and a group only spans nodes when a node holds less than one.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "bitset.h"
+
+#define MAX_AXES 16
+#define SWEEP_MAX_CPUS 1024
+#define SWEEP_MASK_WORDS BITWORDS(SWEEP_MAX_CPUS)
+#define SWEEP_OFF "-"               // the value that leaves an option off
+#define SWEEP_NODES "/sys/devices/system/node/node%d/cpulist"
+#define DEFAULT_SWEEP_RESULTS "sweep.jsonl"
+#define SWEEP_ENV "OSS_SWEEP_RUN"  // set in the environment of every run, which may not sweep in turn
+
+struct sweep_axis {
+    char option;
+    int flag;                       // the option takes no argument
+    int nvalues;
+    char **values;
+};
+
+struct sweep_grid {
+    int naxes;
+    struct sweep_axis axes[MAX_AXES];
+    int *at;                        // the value of each axis in the current combination
+    char letters[MAX_AXES][3];      // "-s" and so on, for the argv of a run
+    char flags[128][3];             // the same for the options every run shares, by letter
+    long runs;                      // combinations in the grid
+};
+
+
+// Adds value to axis, expanding an integer range. Returns 0, or -1 if it can't be allocated.
+static inline int sweep_add(struct sweep_axis *axis, const char *value)
+{
+    char **grown;
+    char *dots = strstr(value, "..");
+    long from = 0, to = 0, i;
+    char number[24];
+
+    if (dots != NULL && isdigit(*value) && isdigit(dots[2]))
+    {
+        from = atol(value);
+        to = atol(dots + 2);
+    }
+    for (i = from; dots == NULL || i <= to; i++)
+    {
+        if ((grown = realloc(axis->values, (axis->nvalues + 1) * sizeof(char *))) == NULL)
+        {
+            return -1;
+        }
+        axis->values = grown;
+        if (dots != NULL)
+        {
+            snprintf(number, sizeof(number), "%ld", i);
+        }
+        if ((axis->values[axis->nvalues++] = strdup(dots != NULL ? number : value)) == NULL)
+        {
+            return -1;
+        }
+        if (dots == NULL)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+
+// Parses spec into grid. options is OSS's getopt string, which says which letters take an argument, and
+// reserved the letters the sweep sets itself. Returns 0, or -1 with a message if spec isn't a grid.
+static inline int sweep_parse(struct sweep_grid *grid, const char *spec, const char *options, const char *reserved)
+{
+    char *copy = strdup(spec), *axis, *value, *save_axis, *save_value, *known;
+    struct sweep_axis *a;
+
+    memset(grid, 0, sizeof(*grid));
+    grid->runs = 1;
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    for (axis = strtok_r(copy, " \t", &save_axis); axis != NULL; axis = strtok_r(NULL, " \t", &save_axis))
+    {
+        if (axis[0] == '\0' || axis[1] != '=' || (known = strchr(options, axis[0])) == NULL || axis[0] == ':' ||
+            strchr(reserved, axis[0]) != NULL)
+        {
+            printf("Error, %s in the grid isn't an option letter with values!\n", axis);
+            free(copy);
+            return -1;
+        }
+        if (grid->naxes == MAX_AXES)
+        {
+            printf("Error, a grid has at most %d axes!\n", MAX_AXES);
+            free(copy);
+            return -1;
+        }
+        a = &grid->axes[grid->naxes++];
+        a->option = axis[0];
+        a->flag = known[1] != ':';
+        for (value = strtok_r(axis + 2, ",", &save_value); value != NULL; value = strtok_r(NULL, ",", &save_value))
+        {
+            if (sweep_add(a, value) == -1)
+            {
+                free(copy);
+                return -1;
+            }
+        }
+        if (a->nvalues == 0)
+        {
+            printf("Error, -%c has no values in the grid!\n", a->option);
+            free(copy);
+            return -1;
+        }
+        grid->runs *= a->nvalues;
+    }
+    free(copy);
+    grid->at = calloc(grid->naxes + 1, sizeof(int));
+    return grid->at == NULL ? -1 : 0;
+}
+
+
+// Takes OSS's command line apart with getopt and puts it back together as the options every run shares: each
+// option on its own, wherever it sat in a group like -rG, less those in reserved. Returns the new argv, with
+// its length in nbase, or NULL if it can't be allocated.
+static inline char **sweep_base(struct sweep_grid *grid, int argc, char **argv, const char *options,
+                                const char *reserved, int *nbase)
+{
+    char **base;
+    size_t room = 1;
+    int i, c;
+
+    // every option takes at least one character of the command line and adds at most two arguments
+    for (i = 0; i < argc; i++)
+    {
+        room += strlen(argv[i]) + 1;
+    }
+    if ((base = malloc(room * sizeof(char *))) == NULL)
+    {
+        return NULL;
+    }
+    base[0] = argv[0];
+    *nbase = 1;
+    optind = 1;
+    opterr = 0;
+    while ((c = getopt(argc, argv, options)) != -1)
+    {
+        if (c == '?' || c == ':' || strchr(reserved, c) != NULL)
+        {
+            continue;
+        }
+        snprintf(grid->flags[c & 127], sizeof(grid->flags[c & 127]), "-%c", c);
+        base[(*nbase)++] = grid->flags[c & 127];
+        if (optarg != NULL && strchr(options, c)[1] == ':')
+        {
+            base[(*nbase)++] = optarg;
+        }
+    }
+    for (i = optind; i < argc; i++)
+    {
+        base[(*nbase)++] = argv[i];
+    }
+    return base;
+}
+
+
+// Moves on to the next combination, the last axis changing fastest. Returns 0 once every one has been had.
+static inline int sweep_next(struct sweep_grid *grid)
+{
+    int i;
+
+    for (i = grid->naxes - 1; i >= 0; i--)
+    {
+        if (++grid->at[i] < grid->axes[i].nvalues)
+        {
+            return 1;
+        }
+        grid->at[i] = 0;
+    }
+    return 0;
+}
+
+
+// Appends the current combination's options to argv from argc on, and writes them to text as well. Returns the
+// new argc.
+static inline int sweep_args(struct sweep_grid *grid, char **argv, int argc, char *text, size_t size)
+{
+    struct sweep_axis *a;
+    size_t used = 0;
+    int i;
+
+    text[0] = '\0';
+    for (i = 0; i < grid->naxes; i++)
+    {
+        a = &grid->axes[i];
+        if (strcmp(a->values[grid->at[i]], SWEEP_OFF) == 0)
+        {
+            continue;
+        }
+        snprintf(grid->letters[i], sizeof(grid->letters[i]), "-%c", a->option);
+        argv[argc++] = grid->letters[i];
+        if (!a->flag)
+        {
+            argv[argc++] = a->values[grid->at[i]];
+        }
+        if (used < size)
+        {
+            used += snprintf(text + used, size - used, "%s%s%s%s", used > 0 ? " " : "", grid->letters[i],
+                             a->flag ? "" : " ", a->flag ? "" : a->values[grid->at[i]]);
+        }
+    }
+    return argc;
+}
+
+
+static inline void sweep_free(struct sweep_grid *grid)
+{
+    int i, j;
+
+    for (i = 0; i < grid->naxes; i++)
+    {
+        for (j = 0; j < grid->axes[i].nvalues; j++)
+        {
+            free(grid->axes[i].values[j]);
+        }
+        free(grid->axes[i].values);
+    }
+    free(grid->at);
+}
+
+
+// Fills cpus with the CPUs this process may run on, those of node 0 first, then node 1 and so on, then any no
+// node lists. Returns how many there are. The affinity calls go through syscall, with a bitset.h mask, because
+// glibc only declares them for _GNU_SOURCE.
+static inline int sweep_cpus(int *cpus)
+{
+    uint64_t allowed[SWEEP_MASK_WORDS] = {0}, placed[SWEEP_MASK_WORDS] = {0};
+    char path[64], list[4096], *range, *save;
+    FILE *fp;
+    int n = 0, node, cpu, from, to;
+
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) == -1)
+    {
+        cpus[0] = 0;
+        return 1;
+    }
+    for (node = 0; snprintf(path, sizeof(path), SWEEP_NODES, node), (fp = fopen(path, "r")) != NULL; node++)
+    {
+        if (fgets(list, sizeof(list), fp) != NULL)
+        {
+            // a list like 0-3,8-11
+            for (range = strtok_r(list, ",\n", &save); range != NULL; range = strtok_r(NULL, ",\n", &save))
+            {
+                from = to = atoi(range);
+                if (strchr(range, '-') != NULL)
+                {
+                    to = atoi(strchr(range, '-') + 1);
+                }
+                for (cpu = from; cpu <= to && cpu < SWEEP_MAX_CPUS; cpu++)
+                {
+                    if (bit_test(allowed, cpu) && !bit_test(placed, cpu))
+                    {
+                        bit_set(placed, cpu);
+                        cpus[n++] = cpu;
+                    }
+                }
+            }
+        }
+        fclose(fp);
+    }
+    for (cpu = 0; cpu < SWEEP_MAX_CPUS; cpu++)
+    {
+        if (bit_test(allowed, cpu) && !bit_test(placed, cpu))
+        {
+            cpus[n++] = cpu;
+        }
+    }
+    return n;
+}
+
+
+// The core group of the slot'th of nslots runs going on at once, out of ncpus ordered CPUs, as a mask and as
+// text. With more slots than CPUs each gets one CPU, shared round the slots.
+static inline void sweep_group(const int *cpus, int ncpus, int slot, int nslots, uint64_t *mask, char *text,
+                               size_t size)
+{
+    int per = ncpus / nslots > 0 ? ncpus / nslots : 1;
+    size_t used = 0;
+    int i, cpu;
+
+    memset(mask, 0, SWEEP_MASK_WORDS * sizeof(uint64_t));
+    text[0] = '\0';
+    for (i = 0; i < per; i++)
+    {
+        cpu = cpus[(slot * per + i) % ncpus];
+        bit_set(mask, cpu);
+        if (used < size)
+        {
+            used += snprintf(text + used, size - used, "%s%d", i > 0 ? "," : "", cpu);
+        }
+    }
+}
+
+
+
+// Pins the calling process, and whatever it forks from then on, to mask. Returns 0, or -1 with errno set.
+static inline int sweep_pin(const uint64_t *mask)
+{
+    return syscall(SYS_sched_setaffinity, 0, SWEEP_MASK_WORDS * sizeof(uint64_t), mask) == -1 ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Joshua Bearden
+ * CS4760 Project 5
+ *
+ * Leveled debug tracing for OSS and User. TRACE(level, fmt, ...) only formats anything when level is at most
+ * both TRACE_MAX, fixed at compile time, and the runtime level taken from TRACE in the environment (a number
+ * or error, info, debug, verbose; the children inherit it). Sites above TRACE_MAX are compiled out entirely,
+ * build with make TRACEFLAGS=-DTRACE_MAX=0 to drop them all; sites above the runtime level cost one compare.
+ *
+ * Enabled trace lines never go to stdout. Each process formats them into its own buffer and writes the buffer
+ * out whole to <name>.<pid>.trace, in TRACE_DIR or the current directory, when it fills and at exit. The file
+ * is opened by trace_init, so writing the buffer out is only ever a write.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TRACE_OFF 0
+#define TRACE_ERROR 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+#define TRACE_VERBOSE 4
+
+#ifndef TRACE_MAX
+#define TRACE_MAX TRACE_DEBUG
+#endif
+
+#define TRACE_BUFSIZE 65536
+#define TRACE_LINEMAX 256
+
+#define TRACE(level, ...) \
+    do \
+    { \
+        if ((level) <= TRACE_MAX && (level) <= trace_level) \
+        { \
+            trace_printf(__VA_ARGS__); \
+        } \
+    } while (0)
+
+static int trace_level = TRACE_OFF;
+static int trace_fd = -1;
+static char trace_buf[TRACE_BUFSIZE];
+static int trace_len = 0;
+
+
+// Writes out whatever is buffered. Only uses write, so it is safe to call from a signal handler on the way out.
+static void trace_flush()
+{
+    int written = 0, n;
+
+    if (trace_len == 0 || trace_fd == -1)
+    {
+        trace_len = 0;
+        return;
+    }
+    while (written < trace_len && (n = write(trace_fd, trace_buf + written, trace_len - written)) > 0)
+    {
+        written += n;
+    }
+    trace_len = 0;
+}
+
+
+static void trace_printf(const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    if (trace_len > TRACE_BUFSIZE - TRACE_LINEMAX)
+    {
+        trace_flush();
+    }
+    va_start(args, fmt);
+    n = vsnprintf(trace_buf + trace_len, TRACE_LINEMAX, fmt, args);
+    va_end(args);
+    trace_len += n < TRACE_LINEMAX ? n : TRACE_LINEMAX - 1;
+}
+
+
+// Reads the runtime level and, if tracing is on, opens this process's trace file. Call once at startup.
+static inline void trace_init(const char *name)
+{
+    const char *level = getenv("TRACE");
+    const char *dir = getenv("TRACE_DIR");
+    char path[PATH_MAX];
+
+    if (level == NULL)
+    {
+        return;
+    }
+    if (strcmp(level, "error") == 0)
+    {
+        trace_level = TRACE_ERROR;
+    }
+    else if (strcmp(level, "info") == 0)
+    {
+        trace_level = TRACE_INFO;
+    }
+    else if (strcmp(level, "debug") == 0)
+    {
+        trace_level = TRACE_DEBUG;
+    }
+    else if (strcmp(level, "verbose") == 0)
+    {
+        trace_level = TRACE_VERBOSE;
+    }
+    else
+    {
+        trace_level = atoi(level);
+    }
+    if (trace_level > TRACE_OFF)
+    {
+        // close-on-exec, so a process this one execs opens a file of its own
+        snprintf(path, sizeof(path), "%s/%s.%d.trace", dir != NULL ? dir : ".", name, (int)getpid());
+        if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+        {
+            trace_level = TRACE_OFF;
+            return;
+        }
+        atexit(trace_flush);
+    }
+}
+
+#endif
@@ -5,6 +5,10 @@
  * This program is designed to be executed by OSS. It simulates a user process that will read a clock within a
  * mutually exclusive critical section (utilizing message queues), add an amount of "work done" to the clock,
  * and send a signal to the parent (OSS) when it terminates.
+ * When OSS runs with -w it is started as a pool worker instead (argv[3] is "pool"): it attaches once and then runs
+ * one process after another as its simpid, parking on its pool slot in between (see pool.h).
+ * What the process does is the state machine in behavior.h, which OSS's simulation engine (-e) runs as well;
+ * this program only carries its messages over the message queue or a ring and does its work on the shared clock.
  *
  * This code includes an excerpt that I obtained from StackOverflow, cited in an inline comment at line 69.
  * The code obtained is simply an elegant solution to generating random numbers greater than RAND_MAX.
@@ -18,224 +22,188 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/ipc.h>
-#include <sys/shm.h>
 #include <signal.h>
 #include <sys/msg.h>
 #include <string.h>
 #include <time.h>
 #include "clock.c"
-#include <semaphore.h>
+#include "message.h"
+#include "ring.h"
+#include "proctable.h"
+#include "bitset.h"
+#include "pool.h"
+#include "trace.h"
+#include "prng.h"
+#include "behavior.h"
+#include "region.h"
 #include <stdbool.h>
+#include <sched.h>
 
 #define BILLION 1000000000
 #define BOUND 2
-#define UPPERBOUND 3
-#define TERMINATIONCONSTANT 1
-#define WORKCONSTANT 500000
-#define SHAREKEY 92195
-#define MSGKEY 110992
-#define TABLEKEY 210995
-#define SEM_NAME "/mutex-semaphore-jbwd4"
-#define TERMINATE 1
-#define REQUEST 2
-#define RELEASE 3
-
-
-int ClockID;
-struct clock *Clock;
-int MsgID;
-int TableID;
+#define INTERRUPT_MSG "Received interrupt!\n"
 
 
-sem_t *sem_for_mutex;
+struct region Region;           // everything shared with the master, see region.h
+uint64_t *Clock;
+int MsgID;
+struct ring_channel *Channel;
+unsigned int reply_seq;
+int transport = TRANSPORT_QUEUE;
+struct master_ctl *Ctl;
+unsigned int generation;
+struct pool_slot *Pool;
+double *zipf_cum;               // the Zipf weights of the run's skew, NULL to pick uniformly
 
-struct mesg_buf {
-    long mtype;
-    char mtext[100];
-} message;
+struct mesg_buf message;
 
 
-// Interrupt handler for SIGUSR1, detaches shared memory and exits cleanly.
+// Interrupt handler for SIGUSR1, exits cleanly. It can land in the middle of a printf, so it only uses
+// async-signal-safe calls; shared memory is detached by _exit.
 static void interrupt()
 {
-    printf("Received interrupt!\n");
-    shmdt(Clock);
-    sem_close(sem_for_mutex);
-    exit(1);
+    write(STDOUT_FILENO, INTERRUPT_MSG, sizeof(INTERRUPT_MSG) - 1);
+    trace_flush();
+    _exit(1);
 }
 
 
-int max_resources(int table[19][20], int current_resources[20], int simpid)
+// Sends the global message to the master and blocks until the master replies to it
+void send_and_wait(int simpid)
 {
-    int i;
-    for(i = 0; i < 20; i++)
+    if (transport == TRANSPORT_RING)
     {
-        if (table[simpid][i] != current_resources[i])
+        while (!ring_push(&Channel->requests, &message))
         {
-            return 0;
+            sched_yield();
         }
+        doorbell_ring(Ctl);
+        reply_seq = ring_await_reply(Channel, reply_seq, &message);
+        return;
     }
-    return 1;
+    msgsnd(MsgID, &message, MSG_BYTES(message.nitems), 0);
+    doorbell_ring(Ctl);
+    msgrcv(MsgID, &message, MSGSIZE, REPLY_MTYPE(simpid), 0);
 }
 
 
-int no_resources(int current_resources[20])
+void do_work()
 {
-    int i;
-    for(i = 0; i < 20; i++)
+    uint64_t now;
+
+    // increment the clock by WORKCONSTANT
+    TRACE(TRACE_VERBOSE, "User about to do work\n");
+    now = advanceClock(Clock, WORKCONSTANT);
+    // if we just moved the clock past the next fork time, the master has work to do
+    if (now >= __atomic_load_n(&Ctl->nextfork, __ATOMIC_RELAXED))
     {
-        if(current_resources[i] > 0)
-        {
-            return 0;
-        }
+        doorbell_ring(Ctl);
     }
-    return 1;
+    TRACE(TRACE_VERBOSE, "User finished doing work.\n");
 }
 
 
-int choose_resource_to_release(int current_resources[20])
+// Runs one simulated process as simpid, from an empty hand until it decides to terminate and the master has
+// acknowledged it
+void run_process(int simpid, struct proc_table *proc_table, struct sim_process *proc)
 {
-    int test;
-    while(true)
+    int what;
+
+    sim_start(proc, proc_table, simpid, generation, getpid());
+    if (transport == TRANSPORT_RING)
     {
-        test = rand() % 20;
-        if (current_resources[test] > 0)
-        {
-            return test;
-        }
+        reply_seq = __atomic_load_n(&Channel->reply_seq, __ATOMIC_ACQUIRE);
     }
-}
-
 
-int choose_resource_to_request(int table[19][20], int current_resources[20], int simpid)
-{
-    int test;
-    while(true)
+    TRACE(TRACE_DEBUG, "User %i: About to enter main loop\n", simpid);
+    while ((what = sim_step(proc, &message)) != SIM_DONE)
     {
-        test = rand() % 20;
-        if(current_resources[test] < table[simpid][test])
+        if (what == SIM_WORK)
         {
-            return test;
+            do_work();
+            continue;
         }
+        if (message.opcode == TERMINATE)
+        {
+            TRACE(TRACE_INFO, "User %i: Time to terminate\n", simpid);
+        }
+        TRACE(TRACE_VERBOSE, "User %i sending message\n", simpid);
+        send_and_wait(simpid);
+        sim_reply(proc, &message);
+        TRACE(TRACE_DEBUG, "User %i received message from Master intended for %li: %d %d, %d pairs\n",
+              simpid, message.mtype, message.pid, message.opcode, message.nitems);
     }
 }
 
 
-void do_work()
-{
-    // access the clock, increment by WORKCONSTANT
-    printf("User about to do work\n");
-    sem_wait(sem_for_mutex);
-    if((Clock->nsec + WORKCONSTANT) >= BILLION)
-    {
-        Clock->sec++;
-        Clock->nsec = Clock->nsec + WORKCONSTANT - BILLION;
-    }
-    else
-    {
-        Clock->nsec += WORKCONSTANT;
-    }
-    sem_post(sem_for_mutex);
-    printf("User finished doing work.\n");
-}
-
-
 int main(int argc, char *argv[]) {
     signal(SIGUSR1, interrupt); // registers interrupt handler
-    int i;
-    int (*proc_table)[20];
-    int current_resources[20];
+    struct proc_table *proc_table;
+    struct sim_process proc;
     int simpid = atoi(argv[1]);
-    int resource;
+    bool pooled = argc > 3 && strcmp(argv[3], POOL_ARG) == 0;
+    unsigned int launch_seq = 0;
+
+    trace_init("user");
+    TRACE(TRACE_INFO, "User: My simpid is %i\n", simpid);
 
-    for (i = 0; i < 20; i++)
+    // maps the region the master passed us as argv[2], making sure it is our master's
+    if (argc < 3 || region_attach(&Region, atoi(argv[2]), getppid()) == -1)
     {
-        current_resources[i] = 0;
+        fprintf(stderr, "User %i: no valid region from the master\n", simpid);
+        exit(1);
     }
-
-    printf("User: My simpid is %i\n", simpid);
-    srand(getpid()); // seeds the random number generator
-
-    // gets and attaches shared memory
-    ClockID = shmget(SHAREKEY, sizeof(int), 0777);
-    Clock = (struct clock *)shmat(ClockID, NULL, 0);
-
-    TableID = shmget(TABLEKEY, sizeof(int[19][20]), 0777);
-    proc_table = shmat(TableID, NULL, 0);
-    proc_table = shmat(TableID, NULL, 0);
-
-    // gets the message queue
-    MsgID = msgget(MSGKEY, 0666);
-
-    printf("User attempting to attach to the semaphore\n");
-
-    if((sem_for_mutex = sem_open(SEM_NAME, 0)) == SEM_FAILED)
+    Clock = Region.clock;
+    Ctl = Region.ctl;
+    Pool = Region.pool;
+
+    // the table tells us how many resource classes there are, and our row holds our maximum claims
+    proc_table = Region.table;
+    zipf_cum = zipf_table(proc_table->skew, proc_table->nresources);
+    if (sim_init(&proc, proc_table, zipf_cum, Clock) == -1)
     {
-        perror("user sem_open");
+        perror("User sim_init");
         exit(1);
     }
 
-    printf("Got the semaphore\n");
+    // our channel if the region has rings, otherwise the master's message queue
+    if (Region.rings != NULL)
+    {
+        transport = TRANSPORT_RING;
+        Channel = &Region.rings[simpid];
+    }
+    else
+    {
+        MsgID = Region.header->msgid;
+    }
 
 //    message.mtype = 2;
 //    sprintf(message.mtext, "%d %d %d %d", getpid(), donesec, donensec, totalwork);
 //    msgsnd(MsgID, &message, sizeof(message), 0);
 
-    printf("User: About to enter main loop\n");
-    while(true)
+    if (pooled)
     {
-        if ((rand() % UPPERBOUND) > 0) {
-            printf("User is doing something!\n");
-            // we either request or release resources
-            //check if resources are full
-            message.mtype = simpid;
-            if (max_resources(proc_table, current_resources, simpid)) {
-                resource = choose_resource_to_release(current_resources);
-                // release the resource
-                sprintf(message.mtext, "%d %d %d", getpid(), RELEASE, resource);
-                current_resources[resource]--;
-            } else if (no_resources(current_resources)) {
-                resource = choose_resource_to_request(proc_table, current_resources, simpid);
-                // request the resource
-                sprintf(message.mtext, "%d %d %d", getpid(), REQUEST, resource);
-                current_resources[resource]++;
-            } else {
-                if ((rand() % 2) == 0) {
-                    // request a resource
-                    resource = choose_resource_to_request(proc_table, current_resources, simpid);
-                    sprintf(message.mtext, "%d %d %d", getpid(), REQUEST, resource);
-                    current_resources[resource]++;
-                } else {
-                    // release a resource
-                    resource = choose_resource_to_request(proc_table, current_resources, simpid);
-                    sprintf(message.mtext, "%d %d %d", getpid(), RELEASE, resource);
-                    current_resources[resource]--;
-                }
-            }
-            printf("User %i sending message\n", simpid);
-            msgsnd(MsgID, &message, sizeof(message), 0);
-            printf("User %i about to wait for a message\n", simpid);
-            msgrcv(MsgID, &message, sizeof(message), simpid, 0);
-            printf("Message received, continuing.\n");
-            printf("User %i received message from Master intended for %li: ", simpid, message.mtype);
-            printf(message.mtext);
-            printf("\n");
-
-
-            // at this point our request was granted, check for termination
-            if ((rand() % 100) == TERMINATIONCONSTANT) {
-                printf("User: Time to terminate\n");
-                //send termination signal
-                message.mtype = simpid;
-                sprintf(message.mtext, "%d %d", getpid(), TERMINATE);
-                msgsnd(MsgID, &message, sizeof(message), 0);
-                msgrcv(MsgID, &message, sizeof(message), simpid, 0);
-                shmdt(Clock);
-                shmdt(proc_table);
-                sem_close(sem_for_mutex);
-                exit(0);
-            }
+        // a pool worker runs one process after another as its simpid, until the master shuts it down.
+        // argv[4] is the launch sequence number the master saw when it started us, so a launch posted
+        // before we got here isn't missed
+        if (argc > 4)
+        {
+            launch_seq = strtoul(argv[4], NULL, 10);
+        }
+        while (true)
+        {
+            launch_seq = pool_await(&Pool[simpid], launch_seq, &generation);
+            run_process(simpid, proc_table, &proc);
         }
-        do_work();
     }
-}
\ No newline at end of file
+
+    if (argc > 3)
+    {
+        generation = strtoul(argv[3], NULL, 10);
+    }
+    run_process(simpid, proc_table, &proc);
+    sim_free(&proc);
+    free(zipf_cum);
+    region_close(&Region);
+    exit(0);
+}